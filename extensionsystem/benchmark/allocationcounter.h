@@ -0,0 +1,20 @@
+﻿#pragma once
+#include <QtGlobal>
+
+namespace Benchmark {
+
+// Heap allocations made by this process. With glibc these are the calls of
+// malloc, calloc and realloc, which covers operator new and Qt's containers;
+// elsewhere only operator new is counted.
+struct AllocationCount
+{
+    quint64 allocations = 0;
+    quint64 bytes = 0;
+};
+
+AllocationCount allocationCount();
+
+// Bytes currently allocated from the C heap, -1 if unknown
+qint64 heapInUse();
+
+} // namespace Benchmark
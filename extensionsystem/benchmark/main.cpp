@@ -0,0 +1,449 @@
+﻿#include "allocationcounter.h"
+#include "syntheticplugins.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include <extensionsystem/pluginmanager.h>
+#include <extensionsystem/pluginspecification.h>
+
+using namespace Benchmark;
+using namespace ExtensionSystem;
+
+namespace {
+
+constexpr char kPluginIID[] = "org.qt-project.Qt.ExtensionSystem.Benchmark";
+// bump when fields of the output change meaning
+constexpr int kOutputFormatVersion = 1;
+constexpr qint64 kMinimumMeasurementTime = 200000000; // ns
+constexpr int kMinimumIterations = 3;
+constexpr int kMaximumIterations = 1000;
+constexpr qint64 kLoadQueueAllocationBase = 16;
+constexpr qint64 kLoadQueueSpecsPerAllocation = 8;
+
+// Runs body until enough time or iterations have been spent. setup and teardown
+// run around every iteration and are not timed.
+template<typename Setup, typename Body, typename Teardown>
+QVector<qint64> measure(Setup setup, Body body, Teardown teardown)
+{
+    QVector<qint64> samples;
+    qint64 total = 0;
+    QElapsedTimer timer;
+    while (samples.size() < kMaximumIterations
+           && (samples.size() < kMinimumIterations || total < kMinimumMeasurementTime)) {
+        setup();
+        timer.start();
+        body();
+        const qint64 elapsed = timer.nsecsElapsed();
+        teardown();
+        samples.append(elapsed);
+        total += elapsed;
+    }
+    return samples;
+}
+
+QJsonObject timing(const QString &name, const QString &shape, int size, QVector<qint64> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    const qint64 median = samples.at(samples.size() / 2);
+    const qint64 sum = std::accumulate(samples.cbegin(), samples.cend(), qint64(0));
+    return {{QLatin1String("name"), name},
+            {QLatin1String("shape"), shape},
+            {QLatin1String("size"), size},
+            {QLatin1String("iterations"), int(samples.size())},
+            {QLatin1String("minNs"), double(samples.first())},
+            {QLatin1String("medianNs"), double(median)},
+            {QLatin1String("meanNs"), double(sum) / samples.size()},
+            {QLatin1String("medianNsPerItem"), double(median) / size}};
+}
+
+void finishDelayedInitialize(PluginManager &manager)
+{
+    while (manager.delayedInitializeStatistics().queueDepth > 0)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+}
+
+void stopPlugins(PluginManager &manager)
+{
+    finishDelayedInitialize(manager);
+    manager.shutdown();
+    manager.setStaticPlugins({});
+}
+
+// Static metadata is decoded from CBOR and validated, as for every static plugin
+QJsonObject benchmarkReadMetaData(const SyntheticPluginGraph &graph)
+{
+    std::vector<std::unique_ptr<PluginSpecification>> specs;
+    const auto setup = [&specs, &graph] {
+        specs.clear();
+        for (int i = 0; i < graph.size(); ++i)
+            specs.push_back(std::make_unique<PluginSpecification>());
+    };
+    const auto body = [&specs, &graph] {
+        for (int i = 0; i < graph.size(); ++i)
+            specs[i]->read(graph.plugins().at(i));
+    };
+    return timing(QLatin1String("readMetaData"),
+                  SyntheticPluginGraph::shapeName(graph.shape()),
+                  graph.size(),
+                  measure(setup, body, [] {}));
+}
+
+// C++ metadata is taken over without parsing
+QJsonObject benchmarkReadStaticMetaData(const SyntheticPluginGraph &graph)
+{
+    std::vector<std::unique_ptr<PluginSpecification>> specs;
+    const auto setup = [&specs, &graph] {
+        specs.clear();
+        for (int i = 0; i < graph.size(); ++i)
+            specs.push_back(std::make_unique<PluginSpecification>());
+    };
+    const auto body = [&specs, &graph] {
+        for (int i = 0; i < graph.size(); ++i)
+            specs[i]->read(graph.staticMetaData().at(i));
+    };
+    return timing(QLatin1String("readStaticMetaData"),
+                  SyntheticPluginGraph::shapeName(graph.shape()),
+                  graph.size(),
+                  measure(setup, body, [] {}));
+}
+
+QJsonObject benchmarkLoadQueue(PluginManager &manager, const SyntheticPluginGraph &graph)
+{
+    manager.setStaticPlugins(graph.plugins());
+    const QVector<qint64> samples = measure([] {}, [&manager] { manager.loadQueue(); }, [] {});
+    manager.setStaticPlugins({});
+    return timing(QLatin1String("loadQueue"),
+                  SyntheticPluginGraph::shapeName(graph.shape()),
+                  graph.size(),
+                  samples);
+}
+
+QJsonObject benchmarkLoadPlugins(PluginManager &manager, const SyntheticPluginGraph &graph)
+{
+    return timing(QLatin1String("loadPlugins"),
+                  SyntheticPluginGraph::shapeName(graph.shape()),
+                  graph.size(),
+                  measure([&manager, &graph] { manager.setStaticPlugins(graph.plugins()); },
+                          [&manager] { manager.loadPlugins(); },
+                          [&manager] { stopPlugins(manager); }));
+}
+
+// reading, resolving and loading, up to the point where delayed initialization starts
+QJsonObject benchmarkStartup(PluginManager &manager, const SyntheticPluginGraph &graph)
+{
+    return timing(QLatin1String("startup"),
+                  SyntheticPluginGraph::shapeName(graph.shape()),
+                  graph.size(),
+                  measure([] {},
+                          [&manager, &graph] {
+                              manager.setStaticPlugins(graph.plugins());
+                              manager.loadPlugins();
+                          },
+                          [&manager] { stopPlugins(manager); }));
+}
+
+QJsonObject benchmarkSpecMemory(const SyntheticPluginGraph &graph)
+{
+    std::vector<std::unique_ptr<PluginSpecification>> specs;
+    specs.reserve(graph.size());
+    const qint64 heapBefore = heapInUse();
+    const AllocationCount before = allocationCount();
+    for (const QStaticPlugin &plugin : graph.plugins()) {
+        specs.push_back(std::make_unique<PluginSpecification>());
+        specs.back()->read(plugin);
+    }
+    const qint64 heapAfter = heapInUse();
+    const AllocationCount after = allocationCount();
+    return {{QLatin1String("name"), QLatin1String("specMemory")},
+            {QLatin1String("shape"), SyntheticPluginGraph::shapeName(graph.shape())},
+            {QLatin1String("size"), graph.size()},
+            {QLatin1String("objectBytes"), int(sizeof(PluginSpecification))},
+            // -1 where the C library cannot report its heap usage
+            {QLatin1String("heapBytesPerSpec"),
+             heapBefore < 0 ? -1.0 : double(heapAfter - heapBefore) / graph.size()},
+            {QLatin1String("allocatedBytesPerSpec"),
+             double(after.bytes - before.bytes) / graph.size()}};
+}
+
+// The accessors the manager uses while moving specs through their states must
+// not allocate.
+QJsonObject benchmarkLoadPathAllocations(PluginManager &manager, const SyntheticPluginGraph &graph)
+{
+    manager.setStaticPlugins(graph.plugins());
+    const QVector<PluginSpecification *> queue = manager.loadQueue();
+    qsizetype visited = 0;
+    const AllocationCount before = allocationCount();
+    for (PluginSpecification *spec : queue) {
+        if (spec->hasError() || !spec->isEffectivelyEnabled() || spec->name().isEmpty())
+            continue;
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
+        for (const PluginDependency &dependency : spec->dependencies()) {
+            if (dependency.type != PluginDependency::Type::Test && deps.value(dependency))
+                visited += deps.value(dependency)->state();
+        }
+        visited += spec->interfaces().size() + spec->arguments().size();
+    }
+    const AllocationCount after = allocationCount();
+    Q_UNUSED(visited)
+    manager.setStaticPlugins({});
+    return {{QLatin1String("name"), QLatin1String("loadPathAllocations")},
+            {QLatin1String("shape"), SyntheticPluginGraph::shapeName(graph.shape())},
+            {QLatin1String("size"), graph.size()},
+            {QLatin1String("allocations"), double(after.allocations - before.allocations)},
+            {QLatin1String("allocationsPerSpec"),
+             double(after.allocations - before.allocations) / graph.size()}};
+}
+
+// The manager's own traversal allocates its result and bookkeeping, whose storage
+// grows in steps, but nothing per spec. A regression that does shows up as about
+// one allocation per spec and breaks the budget.
+QJsonObject benchmarkLoadQueueAllocations(PluginManager &manager, const SyntheticPluginGraph &graph)
+{
+    manager.setStaticPlugins(graph.plugins());
+    manager.loadQueue();
+    const AllocationCount before = allocationCount();
+    const QVector<PluginSpecification *> queue = manager.loadQueue();
+    const AllocationCount after = allocationCount();
+    Q_UNUSED(queue)
+    manager.setStaticPlugins({});
+    const qint64 allocations = after.allocations - before.allocations;
+    const qint64 budget = kLoadQueueAllocationBase + graph.size() / kLoadQueueSpecsPerAllocation;
+    return {{QLatin1String("name"), QLatin1String("loadQueueAllocations")},
+            {QLatin1String("shape"), SyntheticPluginGraph::shapeName(graph.shape())},
+            {QLatin1String("size"), graph.size()},
+            {QLatin1String("allocations"), double(allocations)},
+            {QLatin1String("allocationsPerSpec"), double(allocations) / graph.size()},
+            {QLatin1String("allocationBudget"), double(budget)}};
+}
+
+QJsonArray benchmarkObjectPool(PluginManager &manager, int size)
+{
+    std::vector<std::unique_ptr<QObject>> objects;
+    const auto create = [&objects, size] {
+        for (int i = 0; i < size; ++i)
+            objects.push_back(std::make_unique<QObject>());
+    };
+    const auto add = [&manager, &objects] {
+        for (const std::unique_ptr<QObject> &object : objects)
+            manager.addObject(object.get());
+    };
+    const auto remove = [&manager, &objects] {
+        for (const std::unique_ptr<QObject> &object : objects)
+            manager.removeObject(object.get());
+    };
+    // every write is followed by a read, which publishes a snapshot each time
+    const auto addWithLookups = [&manager, &objects] {
+        for (const std::unique_ptr<QObject> &object : objects) {
+            manager.addObject(object.get());
+            manager.getObject<QObject>();
+        }
+    };
+    const auto destroy = [&objects] { objects.clear(); };
+    const auto createAndAdd = [&create, &add] {
+        create();
+        add();
+    };
+    const auto removeAndDestroy = [&remove, &destroy] {
+        remove();
+        destroy();
+    };
+    const auto lookup = [&manager, size] {
+        for (int i = 0; i < size; ++i) {
+            manager.getObject<QObject>();
+            manager.getObjectByInterface(QLatin1String("org.example.Missing"));
+        }
+    };
+
+    const QString shape = QLatin1String("none");
+    QJsonArray results;
+    results.append(timing(QLatin1String("objectPoolAdd"),
+                          shape,
+                          size,
+                          measure(create, add, removeAndDestroy)));
+    results.append(timing(QLatin1String("objectPoolAddWithLookups"),
+                          shape,
+                          size,
+                          measure(create, addWithLookups, removeAndDestroy)));
+    results.append(timing(QLatin1String("objectPoolLookup"),
+                          shape,
+                          size,
+                          measure(createAndAdd, lookup, removeAndDestroy)));
+    results.append(timing(QLatin1String("objectPoolRemove"),
+                          shape,
+                          size,
+                          measure(createAndAdd, remove, destroy)));
+    return results;
+}
+
+// Several readers look objects up while one writer keeps adding and removing an
+// object. Every sample is one reader doing size lookups, as in objectPoolLookup.
+QJsonObject benchmarkObjectPoolContention(PluginManager &manager, int size)
+{
+    std::vector<std::unique_ptr<QObject>> objects;
+    for (int i = 0; i < size; ++i) {
+        objects.push_back(std::make_unique<QObject>());
+        manager.addObject(objects.back().get());
+    }
+
+    std::atomic<bool> writing = true;
+    std::atomic<qint64> writes = 0;
+    std::unique_ptr<QThread> writer(QThread::create([&manager, &writing, &writes] {
+        QObject object;
+        while (writing.load(std::memory_order_relaxed)) {
+            manager.addObject(&object);
+            manager.removeObject(&object);
+            writes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }));
+    writer->start();
+
+    QMutex samplesMutex;
+    QVector<qint64> samples;
+    const int readerCount = qMax(1, QThread::idealThreadCount() - 1);
+    std::vector<std::unique_ptr<QThread>> readers;
+    for (int i = 0; i < readerCount; ++i) {
+        readers.emplace_back(QThread::create([&manager, &samplesMutex, &samples, size] {
+            const QVector<qint64> readerSamples = measure(
+                [] {},
+                [&manager, size] {
+                    for (int lookup = 0; lookup < size; ++lookup) {
+                        manager.getObject<QObject>();
+                        manager.getObjectByInterface(QLatin1String("org.example.Missing"));
+                    }
+                },
+                [] {});
+            QMutexLocker locker(&samplesMutex);
+            samples += readerSamples;
+        }));
+        readers.back()->start();
+    }
+    for (const std::unique_ptr<QThread> &reader : readers)
+        reader->wait();
+    writing.store(false, std::memory_order_relaxed);
+    writer->wait();
+
+    for (const std::unique_ptr<QObject> &object : objects)
+        manager.removeObject(object.get());
+    QJsonObject result = timing(QLatin1String("objectPoolContendedLookup"),
+                                QLatin1String("none"),
+                                size,
+                                samples);
+    result.insert(QLatin1String("readers"), readerCount);
+    result.insert(QLatin1String("writes"), double(writes.load()));
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QLatin1String("ExtensionSystemBenchmark"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String(
+        "Measures the extension system on synthetic static plugin graphs and prints the "
+        "results as JSON."));
+    parser.addHelpOption();
+    const QCommandLineOption sizesOption(QLatin1String("sizes"),
+                                         QLatin1String("Comma separated plugin counts."),
+                                         QLatin1String("sizes"),
+                                         QLatin1String("10,100,1000,10000"));
+    const QCommandLineOption shapesOption(QLatin1String("shapes"),
+                                          QLatin1String("Comma separated graph shapes: "
+                                                        "chain, wide, diamond, dense."),
+                                          QLatin1String("shapes"),
+                                          QLatin1String("chain,wide,diamond,dense"));
+    const QCommandLineOption outputOption(QLatin1String("output"),
+                                          QLatin1String("Write the results to <file> "
+                                                        "instead of stdout."),
+                                          QLatin1String("file"));
+    const QCommandLineOption ignoreAllocationsOption(
+        QLatin1String("ignore-allocations"),
+        QLatin1String("Do not fail if the load path accessors allocate or loadQueue() "
+                      "allocates per spec."));
+    parser.addOptions({sizesOption, shapesOption, outputOption, ignoreAllocationsOption});
+    parser.process(app);
+
+    QVector<int> sizes;
+    for (const QString &value : parser.value(sizesOption).split(QLatin1Char(','))) {
+        bool ok = false;
+        const int size = value.trimmed().toInt(&ok);
+        if (!ok || size <= 0) {
+            qCritical().noquote() << "Invalid size:" << value;
+            return 1;
+        }
+        sizes.append(size);
+    }
+    QVector<GraphShape> shapes;
+    for (const QString &value : parser.value(shapesOption).split(QLatin1Char(','))) {
+        const std::optional<GraphShape> shape = SyntheticPluginGraph::shapeFromName(value.trimmed());
+        if (!shape) {
+            qCritical().noquote() << "Invalid shape:" << value;
+            return 1;
+        }
+        shapes.append(*shape);
+    }
+
+    PluginManager &manager = PluginManager::instance();
+    manager.setPluginIID(QLatin1String(kPluginIID));
+
+    QJsonArray results;
+    bool allocationFree = true;
+    for (int size : std::as_const(sizes)) {
+        for (GraphShape shape : std::as_const(shapes)) {
+            const SyntheticPluginGraph graph(shape, size, QLatin1String(kPluginIID));
+            results.append(benchmarkReadMetaData(graph));
+            results.append(benchmarkReadStaticMetaData(graph));
+            results.append(benchmarkLoadQueue(manager, graph));
+            results.append(benchmarkLoadPlugins(manager, graph));
+            results.append(benchmarkStartup(manager, graph));
+            results.append(benchmarkSpecMemory(graph));
+            const QJsonObject allocations = benchmarkLoadPathAllocations(manager, graph);
+            allocationFree = allocationFree && allocations.value(QLatin1String("allocations")).toDouble() == 0;
+            results.append(allocations);
+            const QJsonObject queueAllocations = benchmarkLoadQueueAllocations(manager, graph);
+            allocationFree = allocationFree
+                             && queueAllocations.value(QLatin1String("allocations")).toDouble()
+                                    <= queueAllocations.value(QLatin1String("allocationBudget")).toDouble();
+            results.append(queueAllocations);
+        }
+        for (const QJsonValue &result : benchmarkObjectPool(manager, size))
+            results.append(result);
+        results.append(benchmarkObjectPoolContention(manager, size));
+    }
+
+    const QJsonObject report{{QLatin1String("benchmark"), QLatin1String("ExtensionSystem")},
+                             {QLatin1String("formatVersion"), kOutputFormatVersion},
+                             {QLatin1String("qtVersion"), QLatin1String(qVersion())},
+                             {QLatin1String("results"), results}};
+    const QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) < 0) {
+            qCritical().noquote() << "Cannot write" << file.fileName();
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (!parser.isSet(ignoreAllocationsOption) && !allocationFree) {
+        qCritical() << "The load path allocated, see loadPathAllocations and loadQueueAllocations";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+﻿#include "syntheticplugins.h"
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <cmath>
+#include <extensionsystem/iplugin.h>
+
+namespace Benchmark {
+
+namespace {
+
+constexpr char kVersion[] = "1.0.0";
+constexpr int kDenseFanOut = 10;
+
+// QStaticPlugin takes its metadata from a function without context, the
+// constructor calls it once and keeps the pointer.
+const QByteArray *g_nextMetaData = nullptr;
+
+QPluginMetaData nextMetaData()
+{
+    return {g_nextMetaData->constData(), size_t(g_nextMetaData->size())};
+}
+
+QObject *createPlugin()
+{
+    return new ExtensionSystem::IPlugin;
+}
+
+QString pluginName(int index)
+{
+    return QString::fromLatin1("Node%1").arg(index, 5, 10, QLatin1Char('0'));
+}
+
+QVector<int> dependenciesOf(GraphShape shape, int index, int width)
+{
+    switch (shape) {
+    case GraphShape::Chain:
+        if (index > 0)
+            return {index - 1};
+        break;
+    case GraphShape::Wide:
+        if (index > 0)
+            return {0};
+        break;
+    case GraphShape::Diamond: {
+        const int layer = index / width;
+        const int position = index % width;
+        if (layer > 0)
+            return {(layer - 1) * width + position, (layer - 1) * width + (position + 1) % width};
+        break;
+    }
+    case GraphShape::Dense: {
+        // multiplicative hashing spreads the edges, so traversal keeps jumping around
+        QVector<int> dependencies;
+        for (int k = 0; k < kDenseFanOut && dependencies.size() < index; ++k) {
+            int dependency = int((quint64(index) * 2654435761u + quint64(k) * 40503u) % quint64(index));
+            while (dependencies.contains(dependency))
+                dependency = (dependency + 1) % index;
+            dependencies.append(dependency);
+        }
+        return dependencies;
+    }
+    }
+    return {};
+}
+
+} // namespace
+
+SyntheticPluginGraph::SyntheticPluginGraph(GraphShape shape, int size, const QString &pluginIID)
+    : m_shape(shape)
+{
+    m_metaData.reserve(size);
+    m_plugins.reserve(size);
+    m_names.reserve(size);
+    m_dependencies.reserve(size);
+    m_staticMetaData.reserve(size);
+    const int width = qMax(2, int(std::sqrt(double(size))));
+    const auto view = [](const QByteArray &value) {
+        return std::string_view(value.constData(), size_t(value.size()));
+    };
+    for (int i = 0; i < size; ++i) {
+        m_names.append(pluginName(i).toUtf8());
+        QCborArray dependencies;
+        std::vector<ExtensionSystem::StaticPluginDependency> &staticDependencies
+            = m_dependencies.emplace_back();
+        for (int dependency : dependenciesOf(shape, i, width)) {
+            dependencies.append(QCborMap{{QLatin1String("Name"), pluginName(dependency)},
+                                         {QLatin1String("Version"), QLatin1String(kVersion)}});
+            staticDependencies.push_back({view(m_names.at(dependency)),
+                                          ExtensionSystem::pluginVersion(kVersion)});
+        }
+        m_staticMetaData.push_back({.name = view(m_names.at(i)),
+                                    .version = ExtensionSystem::pluginVersion(kVersion),
+                                    .instance = &createPlugin,
+                                    .vendor = "Benchmark",
+                                    .category = "Benchmark",
+                                    .copyright = "(C) Benchmark",
+                                    .description = "Synthetic plugin",
+                                    .url = "https://example.org",
+                                    .license = "Synthetic license\nfor benchmarks only",
+                                    .dependencies = staticDependencies});
+        const QCborMap metaData{
+            {QLatin1String("Name"), pluginName(i)},
+            {QLatin1String("Version"), QLatin1String(kVersion)},
+            {QLatin1String("CompatVersion"), QLatin1String(kVersion)},
+            {QLatin1String("Vendor"), QLatin1String("Benchmark")},
+            {QLatin1String("Category"), QLatin1String("Benchmark")},
+            {QLatin1String("Copyright"), QLatin1String("(C) Benchmark")},
+            {QLatin1String("Description"), QLatin1String("Synthetic plugin")},
+            {QLatin1String("Url"), QLatin1String("https://example.org")},
+            {QLatin1String("License"), QCborArray{QLatin1String("Synthetic license"),
+                                                  QLatin1String("for benchmarks only")}},
+            {QLatin1String("Dependencies"), dependencies}};
+        const QCborMap plugin{{int(QtPluginMetaDataKeys::IID), pluginIID},
+                              {int(QtPluginMetaDataKeys::ClassName),
+                               QLatin1String("ExtensionSystem::IPlugin")},
+                              {int(QtPluginMetaDataKeys::MetaData), metaData}};
+
+        // laid out like the static plugin metadata moc generates
+        const QPluginMetaData::Header header;
+        QByteArray data(reinterpret_cast<const char *>(&header), sizeof(header));
+        data += plugin.toCborValue().toCbor();
+        m_metaData.append(data);
+        g_nextMetaData = &m_metaData.last();
+        m_plugins.append(QStaticPlugin(&createPlugin, &nextMetaData));
+    }
+    g_nextMetaData = nullptr;
+}
+
+QString SyntheticPluginGraph::shapeName(GraphShape shape)
+{
+    switch (shape) {
+    case GraphShape::Chain:
+        return QLatin1String("chain");
+    case GraphShape::Wide:
+        return QLatin1String("wide");
+    case GraphShape::Diamond:
+        return QLatin1String("diamond");
+    case GraphShape::Dense:
+        return QLatin1String("dense");
+    }
+    return QString();
+}
+
+std::optional<GraphShape> SyntheticPluginGraph::shapeFromName(const QString &name)
+{
+    for (GraphShape shape : {GraphShape::Chain, GraphShape::Wide, GraphShape::Diamond, GraphShape::Dense}) {
+        if (shapeName(shape) == name)
+            return shape;
+    }
+    return std::nullopt;
+}
+
+} // namespace Benchmark
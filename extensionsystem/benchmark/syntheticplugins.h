@@ -0,0 +1,50 @@
+﻿#pragma once
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QtPlugin>
+#include <optional>
+#include <vector>
+#include <extensionsystem/staticpluginmetadata.h>
+
+namespace Benchmark {
+
+enum class GraphShape
+{
+    Chain,   // every plugin depends on the one before it
+    Wide,    // every plugin depends on the first one
+    Diamond, // layers of sqrt(size) plugins, each depending on two of the layer before
+    Dense    // every plugin depends on up to ten earlier ones from all over the graph
+};
+
+// A plugin graph made of static plugins that only exist in memory. Dependencies
+// always point at plugins generated earlier, so every graph resolves.
+class SyntheticPluginGraph
+{
+public:
+    SyntheticPluginGraph(GraphShape shape, int size, const QString &pluginIID);
+
+    GraphShape shape() const { return m_shape; }
+    int size() const { return int(m_plugins.size()); }
+    const QVector<QStaticPlugin> &plugins() const { return m_plugins; }
+    // the same graph declared with C++ metadata
+    const std::vector<ExtensionSystem::StaticPluginMetaData> &staticMetaData() const
+    {
+        return m_staticMetaData;
+    }
+
+    static QString shapeName(GraphShape shape);
+    static std::optional<GraphShape> shapeFromName(const QString &name);
+
+private:
+    GraphShape m_shape;
+    // QStaticPlugin points into these
+    QVector<QByteArray> m_metaData;
+    QVector<QStaticPlugin> m_plugins;
+    // StaticPluginMetaData points into these
+    QVector<QByteArray> m_names;
+    std::vector<std::vector<ExtensionSystem::StaticPluginDependency>> m_dependencies;
+    std::vector<ExtensionSystem::StaticPluginMetaData> m_staticMetaData;
+};
+
+} // namespace Benchmark
@@ -0,0 +1,318 @@
+﻿#include "elfpluginprobe.h"
+#include <QFile>
+#include <cstring>
+
+namespace ExtensionSystem {
+
+namespace Constants
+{
+constexpr char kElfMagic[] = "\x7f" "ELF";
+constexpr char kQtMetaDataSection[] = ".qtmetadata";
+constexpr char kQtMetaDataNoteSection[] = ".note.qt.metadata";
+constexpr char kQtMetaDataNoteName[] = "qt-project!";
+constexpr char kQtMetaDataMagic[] = "QTMETADATA !";
+constexpr qint64 kQtMetaDataHeaderSize = 4;
+constexpr quint64 kCborIidKey = 2;
+constexpr int kCborMaxDepth = 32;
+}
+
+namespace
+{
+
+struct ElfReader
+{
+    const uchar *data;
+    qint64 size;
+    bool bigEndian;
+
+    bool contains(quint64 offset, quint64 length) const
+    {
+        return offset <= quint64(size) && length <= quint64(size) - offset;
+    }
+
+    quint64 read(quint64 offset, int width) const
+    {
+        quint64 value = 0;
+        for (int i = 0; i < width; ++i) {
+            const quint64 byte = data[offset + (bigEndian ? i : width - 1 - i)];
+            value = (value << 8) | byte;
+        }
+        return value;
+    }
+};
+
+struct Section
+{
+    quint64 offset = 0;
+    quint64 size = 0;
+};
+
+class CborReader
+{
+public:
+    CborReader(const uchar *data, quint64 size)
+        : m_data(data)
+        , m_end(size)
+    {}
+
+    // reads the initial byte of an item and its argument
+    bool readHead(int *major, quint64 *argument, bool *indefinite)
+    {
+        if (m_pos >= m_end)
+            return false;
+        const uchar initial = m_data[m_pos++];
+        *major = initial >> 5;
+        const int info = initial & 0x1f;
+        *indefinite = false;
+        if (info < 24) {
+            *argument = quint64(info);
+            return true;
+        }
+        if (info == 31) {
+            *indefinite = true;
+            *argument = 0;
+            return *major >= 2;
+        }
+        if (info > 27)
+            return false;
+        const quint64 width = quint64(1) << (info - 24);
+        if (width > m_end - m_pos)
+            return false;
+        quint64 value = 0;
+        for (quint64 i = 0; i < width; ++i)
+            value = (value << 8) | m_data[m_pos++];
+        *argument = value;
+        return true;
+    }
+
+    bool atBreak() const { return m_pos < m_end && m_data[m_pos] == 0xff; }
+    void skipBreak() { ++m_pos; }
+
+    bool skipBytes(quint64 length)
+    {
+        if (length > m_end - m_pos)
+            return false;
+        m_pos += length;
+        return true;
+    }
+
+    const uchar *current() const { return m_data + m_pos; }
+
+    bool skipItem(int depth = 0)
+    {
+        if (depth > Constants::kCborMaxDepth)
+            return false;
+        int major = 0;
+        quint64 argument = 0;
+        bool indefinite = false;
+        if (!readHead(&major, &argument, &indefinite))
+            return false;
+        switch (major) {
+        case 0:
+        case 1:
+            return true;
+        case 2:
+        case 3:
+            if (!indefinite)
+                return skipBytes(argument);
+            while (!atBreak()) {
+                if (!skipItem(depth + 1))
+                    return false;
+            }
+            skipBreak();
+            return true;
+        case 4:
+        case 5: {
+            const quint64 factor = major == 5 ? 2 : 1;
+            if (!indefinite) {
+                if (argument > (m_end - m_pos) / factor)
+                    return false;
+                for (quint64 i = 0; i < argument * factor; ++i) {
+                    if (!skipItem(depth + 1))
+                        return false;
+                }
+                return true;
+            }
+            while (!atBreak()) {
+                if (!skipItem(depth + 1))
+                    return false;
+            }
+            skipBreak();
+            return true;
+        }
+        case 6:
+            return skipItem(depth + 1);
+        default:
+            // simple values and floats carry everything in their argument
+            return !indefinite;
+        }
+    }
+
+private:
+    const uchar *m_data;
+    quint64 m_end;
+    quint64 m_pos = 0;
+};
+
+PluginProbeResult matchIid(const uchar *cbor, quint64 size, const QByteArray &pluginIID)
+{
+    CborReader reader(cbor, size);
+    int major = 0;
+    quint64 count = 0;
+    bool indefinite = false;
+    if (!reader.readHead(&major, &count, &indefinite) || major != 5)
+        return PluginProbeResult::Unknown;
+
+    for (quint64 i = 0; indefinite || i < count; ++i) {
+        if (indefinite && reader.atBreak())
+            break;
+        int keyMajor = 0;
+        quint64 key = 0;
+        bool keyIndefinite = false;
+        if (!reader.readHead(&keyMajor, &key, &keyIndefinite))
+            return PluginProbeResult::Unknown;
+        if (keyMajor != 0) {
+            // tolerate text keys, only the integer IID key is of interest
+            if (keyMajor != 3 || keyIndefinite || !reader.skipBytes(key) || !reader.skipItem())
+                return PluginProbeResult::Unknown;
+            continue;
+        }
+        if (key != Constants::kCborIidKey) {
+            if (!reader.skipItem())
+                return PluginProbeResult::Unknown;
+            continue;
+        }
+        int valueMajor = 0;
+        quint64 length = 0;
+        bool valueIndefinite = false;
+        if (!reader.readHead(&valueMajor, &length, &valueIndefinite))
+            return PluginProbeResult::Unknown;
+        if (valueMajor != 3)
+            return PluginProbeResult::NotAPlugin;
+        if (valueIndefinite)
+            return PluginProbeResult::Unknown;
+        const uchar *iid = reader.current();
+        if (!reader.skipBytes(length))
+            return PluginProbeResult::Unknown;
+        const bool matches = length == quint64(pluginIID.size())
+                             && std::memcmp(iid, pluginIID.constData(), length) == 0;
+        return matches ? PluginProbeResult::IidMatch : PluginProbeResult::IidMismatch;
+    }
+    return PluginProbeResult::NotAPlugin;
+}
+
+PluginProbeResult probeNote(const ElfReader &elf, const Section &section, const QByteArray &pluginIID)
+{
+    const quint64 nameSize = sizeof(Constants::kQtMetaDataNoteName);
+    quint64 pos = section.offset;
+    const quint64 end = section.offset + section.size;
+    while (pos + 12 <= end) {
+        const quint64 namesz = elf.read(pos, 4);
+        const quint64 descsz = elf.read(pos + 4, 4);
+        const quint64 name = pos + 12;
+        const quint64 desc = name + ((namesz + 3) & ~quint64(3));
+        if (desc > end || descsz > end - desc)
+            return PluginProbeResult::Unknown;
+        if (namesz == nameSize
+            && std::memcmp(elf.data + name, Constants::kQtMetaDataNoteName, nameSize) == 0) {
+            quint64 payload = desc;
+            quint64 payloadSize = descsz;
+            const quint64 magicSize = sizeof(Constants::kQtMetaDataMagic) - 1;
+            if (payloadSize >= magicSize
+                && std::memcmp(elf.data + payload, Constants::kQtMetaDataMagic, magicSize) == 0) {
+                payload += magicSize;
+                payloadSize -= magicSize;
+            }
+            if (payloadSize < quint64(Constants::kQtMetaDataHeaderSize))
+                return PluginProbeResult::Unknown;
+            return matchIid(elf.data + payload + Constants::kQtMetaDataHeaderSize,
+                            payloadSize - Constants::kQtMetaDataHeaderSize,
+                            pluginIID);
+        }
+        pos = desc + ((descsz + 3) & ~quint64(3));
+    }
+    return PluginProbeResult::NotAPlugin;
+}
+
+PluginProbeResult probeSection(const ElfReader &elf, const Section &section, const QByteArray &pluginIID)
+{
+    const quint64 magicSize = sizeof(Constants::kQtMetaDataMagic) - 1;
+    const quint64 prefix = magicSize + Constants::kQtMetaDataHeaderSize;
+    // older layouts (e.g. binary JSON) are left to QPluginLoader
+    if (section.size < prefix
+        || std::memcmp(elf.data + section.offset, Constants::kQtMetaDataMagic, magicSize) != 0) {
+        return PluginProbeResult::Unknown;
+    }
+    return matchIid(elf.data + section.offset + prefix, section.size - prefix, pluginIID);
+}
+
+} // namespace
+
+PluginProbeResult probeElfPlugin(const uchar *data, qint64 size, const QByteArray &pluginIID)
+{
+    if (size < 0x40 || std::memcmp(data, Constants::kElfMagic, 4) != 0)
+        return PluginProbeResult::Unknown;
+    const bool is64 = data[4] == 2;
+    if ((data[4] != 1 && !is64) || (data[5] != 1 && data[5] != 2))
+        return PluginProbeResult::Unknown;
+    const ElfReader elf{data, size, data[5] == 2};
+
+    const quint64 shoff = is64 ? elf.read(0x28, 8) : elf.read(0x20, 4);
+    const quint64 shentsize = elf.read(is64 ? 0x3a : 0x2e, 2);
+    const quint64 shnum = elf.read(is64 ? 0x3c : 0x30, 2);
+    const quint64 shstrndx = elf.read(is64 ? 0x3e : 0x32, 2);
+    const quint64 minEntSize = is64 ? 0x40 : 0x28;
+    // extended section numbering and stripped section tables go the slow way
+    if (shoff == 0 || shnum == 0 || shstrndx >= shnum || shentsize < minEntSize
+        || shnum > quint64(size) / shentsize || !elf.contains(shoff, shnum * shentsize)) {
+        return PluginProbeResult::Unknown;
+    }
+
+    const auto sectionAt = [&](quint64 index) {
+        const quint64 header = shoff + index * shentsize;
+        Section section;
+        section.offset = is64 ? elf.read(header + 0x18, 8) : elf.read(header + 0x10, 4);
+        section.size = is64 ? elf.read(header + 0x20, 8) : elf.read(header + 0x14, 4);
+        return section;
+    };
+    const Section names = sectionAt(shstrndx);
+    if (!elf.contains(names.offset, names.size))
+        return PluginProbeResult::Unknown;
+
+    constexpr quint64 kNoBits = 8;
+    for (quint64 i = 0; i < shnum; ++i) {
+        const quint64 header = shoff + i * shentsize;
+        const quint64 nameOffset = elf.read(header, 4);
+        if (nameOffset >= names.size || elf.read(header + 4, 4) == kNoBits)
+            continue;
+        const char *name = reinterpret_cast<const char *>(data + names.offset + nameOffset);
+        const quint64 maxLength = names.size - nameOffset;
+        const bool isNote = qstrncmp(name, Constants::kQtMetaDataNoteSection, maxLength) == 0
+                            && sizeof(Constants::kQtMetaDataNoteSection) <= maxLength;
+        const bool isSection = qstrncmp(name, Constants::kQtMetaDataSection, maxLength) == 0
+                               && sizeof(Constants::kQtMetaDataSection) <= maxLength;
+        if (!isNote && !isSection)
+            continue;
+        const Section section = sectionAt(i);
+        if (!elf.contains(section.offset, section.size))
+            return PluginProbeResult::Unknown;
+        return isNote ? probeNote(elf, section, pluginIID) : probeSection(elf, section, pluginIID);
+    }
+    return PluginProbeResult::NotAPlugin;
+}
+
+PluginProbeResult probeElfPlugin(const QString &filePath, const QByteArray &pluginIID)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return PluginProbeResult::Unknown;
+    const qint64 size = file.size();
+    uchar *data = file.map(0, size);
+    if (!data)
+        return PluginProbeResult::Unknown;
+    const PluginProbeResult result = probeElfPlugin(data, size, pluginIID);
+    file.unmap(data);
+    return result;
+}
+
+} // namespace ExtensionSystem
@@ -0,0 +1,22 @@
+﻿#pragma once
+#include <QByteArray>
+#include <QString>
+
+namespace ExtensionSystem {
+
+enum class PluginProbeResult
+{
+    Unknown,
+    NotAPlugin,
+    IidMismatch,
+    IidMatch
+};
+
+// Looks at the Qt plugin metadata of an ELF library through a read-only mapping
+// and extracts only the IID, without handing the file to QPluginLoader and without
+// decoding the rest of the metadata. Unknown means the caller has to fall back to
+// QPluginLoader, e.g. for non-ELF files or metadata formats that are not understood.
+PluginProbeResult probeElfPlugin(const QString &filePath, const QByteArray &pluginIID);
+PluginProbeResult probeElfPlugin(const uchar *data, qint64 size, const QByteArray &pluginIID);
+
+} // namespace ExtensionSystem
@@ -0,0 +1,27 @@
+﻿#include "libraryprefetch.h"
+#include <QFile>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ExtensionSystem {
+
+bool prefetchLibrary(const QString &filePath)
+{
+#if defined(Q_OS_LINUX)
+    const int fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    // WILLNEED only queues the readahead, the pages arrive while the caller moves on
+    const bool queued = ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+    ::close(fd);
+    return queued;
+#else
+    Q_UNUSED(filePath)
+    return false;
+#endif
+}
+
+} // namespace ExtensionSystem
@@ -0,0 +1,11 @@
+﻿#pragma once
+#include <QString>
+
+namespace ExtensionSystem {
+
+// Asks the kernel to read a library into the page cache in the background, so that
+// loading it later finds its pages resident instead of faulting them in one by one.
+// Returns false where this is not supported or the file cannot be opened.
+bool prefetchLibrary(const QString &filePath);
+
+} // namespace ExtensionSystem
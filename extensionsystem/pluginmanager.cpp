@@ -1,7 +1,21 @@
 ﻿#include "pluginmanager.h"
 
 #include "extensionsystemtr.h"
+#include "libraryprefetch.h"
+#include "pluginmetadatacache.h"
+#include "pluginpathwatcher.h"
 #include "pluginspecification.h"
+#include "pluginstartupsnapshot.h"
+#include <QDebug>
+#include <QDir>
+#include <QLibrary>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <algorithm>
+#include <memory>
+#include <optional>
 #include <utils/algorithm.h>
 #include <utils/hostinfo.h>
 
@@ -9,51 +23,431 @@
 namespace ExtensionSystem
 {
 constexpr int kDelayedInitializeInterval = 20;
-PluginManager::PluginManager() {}
+constexpr int kDefaultDelayedInitializeBudget = 10;
+constexpr int kMaxDelayedInitializeInterval = 200;
+constexpr int kDefaultShutdownTimeout = 30000;
+constexpr int kDefaultPluginShutdownTimeout = 10000;
+// EXTENSIONSYSTEM_PROFILE prints a per-plugin summary once initialization is done,
+// EXTENSIONSYSTEM_PROFILE_TRACE names a file that receives a Chrome trace as well
+constexpr char kProfileEnvironmentVariable[] = "EXTENSIONSYSTEM_PROFILE";
+constexpr char kProfileTraceEnvironmentVariable[] = "EXTENSIONSYSTEM_PROFILE_TRACE";
 
-bool PluginManager::loadQueue(PluginSpecification *spec, QVector<PluginSpecification *> &queue, QVector<PluginSpecification *> &circularityCheckQueue)
+PluginManager::PluginManager()
+    : m_objectPool(std::make_shared<const ObjectPoolSnapshot>())
+    , m_shutdownTimeout(kDefaultShutdownTimeout)
+    , m_pluginShutdownTimeout(kDefaultPluginShutdownTimeout)
+    , m_delayedInitializeBudget(kDefaultDelayedInitializeBudget)
+    , m_profileTraceFile(qEnvironmentVariable(kProfileTraceEnvironmentVariable))
 {
-    if (queue.contains(spec))
-        return true;
-    // check for circular dependencies
-    if (circularityCheckQueue.contains(spec)) {
-        spec->m_errorString = Tr::tr("Circular dependency detected:");
-        spec->m_errorString.value() += QLatin1Char('\n');
-        int index = circularityCheckQueue.indexOf(spec);
-        for (int i = index; i < circularityCheckQueue.size(); ++i) {
-            const PluginSpecification *depSpec = circularityCheckQueue.at(i);
-            spec->m_errorString.value().append(Tr::tr("%1 (%2) depends on")
-                                            .arg(depSpec->name(), depSpec->version()));
-            spec->m_errorString.value() += QLatin1Char('\n');
+    m_delayedInitializeTimer.setSingleShot(true);
+    connect(&m_delayedInitializeTimer,
+            &QTimer::timeout,
+            this,
+            &PluginManager::startDelayedInitialize);
+    m_delayedInitializeClock.start();
+    if (qEnvironmentVariableIsSet(kProfileEnvironmentVariable) || !m_profileTraceFile.isEmpty())
+        m_profiler.setEnabled(true);
+}
+
+PluginManager::~PluginManager()
+{
+    qDeleteAll(m_pluginSpecs);
+}
+
+static QStringList pluginFiles(const QStringList &pluginPaths)
+{
+    QStringList pluginFiles;
+    QStringList searchPaths = pluginPaths;
+    while (!searchPaths.isEmpty()) {
+        const QDir dir(searchPaths.takeFirst());
+        const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::NoSymLinks, QDir::Name);
+        for (const QFileInfo &file : files) {
+            const QString filePath = file.absoluteFilePath();
+            if (QLibrary::isLibrary(filePath))
+                pluginFiles.append(filePath);
         }
-        spec->m_errorString.value().append(Tr::tr("%1 (%2)").arg(spec->name(), spec->version()));
-        return false;
+        const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+        for (const QFileInfo &subdir : dirs)
+            searchPaths << subdir.absoluteFilePath();
     }
-    circularityCheckQueue.append(spec);
-    // check if we have the dependencies
-    if (spec->state() == PluginState::Invalid || spec->state() == PluginState::Read) {
-        queue.append(spec);
-        return false;
+    return pluginFiles;
+}
+
+void PluginManager::readPluginPaths()
+{
+    clearLazyInterfaces();
+    qDeleteAll(m_pluginSpecs);
+    m_pluginSpecs.clear();
+
+    const QStringList files = pluginFiles(m_pluginPaths);
+    // Static plugins, then plugins with C++ metadata follow the files in the same
+    // slots. They are validated like libraries, but neither touch the file system
+    // nor need dlopen.
+    const qsizetype count = files.size() + m_staticPlugins.size() + m_staticMetaData.size();
+    // Every worker owns the slots it picks, so merging back in slot order keeps
+    // the spec list (and with it the load order) independent of scheduling.
+    QVector<PluginSpecification *> specs(count, nullptr);
+    std::unique_ptr<PluginMetaDataCache> cache;
+    if (!m_metaDataCacheFile.isEmpty() && !files.isEmpty())
+        cache = std::make_unique<PluginMetaDataCache>(m_metaDataCacheFile, m_pluginIID);
+    QAtomicInteger<qsizetype> nextSlot = 0;
+    QThread *ownerThread = thread();
+    const auto readFiles = [this, &files, &specs, count, &nextSlot, &cache, ownerThread] {
+        for (qsizetype i = nextSlot.fetchAndAddRelaxed(1); i < count;
+             i = nextSlot.fetchAndAddRelaxed(1)) {
+            if (i >= files.size()) {
+                const qsizetype index = i - files.size();
+                auto spec = std::make_unique<PluginSpecification>();
+                const bool isRead = index < m_staticPlugins.size()
+                                        ? spec->read(m_staticPlugins.at(index))
+                                        : spec->read(*m_staticMetaData.at(index - m_staticPlugins.size()));
+                if (isRead)
+                    specs[i] = spec.release();
+                continue;
+            }
+            const QString &filePath = files.at(i);
+            // keyed by the path until the plugin has a name, like every other phase
+            PluginProfiler::Scope profile(m_profiler, ProfilePhase::Read, filePath);
+            auto spec = std::make_unique<PluginSpecification>();
+            if (cache) {
+                const PluginFileIdentity identity = PluginFileIdentity::fromFile(filePath);
+                bool isPlugin = false;
+                if (cache->lookup(filePath, identity, spec.get(), &isPlugin)) {
+                    if (isPlugin) {
+                        profile.setPluginName(spec->name());
+                        specs[i] = spec.release();
+                    }
+                    continue;
+                }
+                const bool isRead = spec->read(filePath);
+                cache->insert(filePath, identity, isRead ? spec.get() : nullptr);
+                if (!isRead)
+                    continue;
+            } else if (!spec->read(filePath)) {
+                continue;
+            }
+            profile.setPluginName(spec->name());
+            // the loader is created on the worker, hand it over before the worker goes away
+            if (spec->m_loader)
+                spec->m_loader->moveToThread(ownerThread);
+            specs[i] = spec.release();
+        }
+    };
+
+    const int workerCount = int(qMin<qsizetype>(QThread::idealThreadCount(), count));
+    if (workerCount > 1) {
+        QThreadPool pool;
+        pool.setMaxThreadCount(workerCount);
+        for (int i = 0; i < workerCount; ++i)
+            pool.start(readFiles);
+        pool.waitForDone();
+    } else {
+        readFiles();
     }
 
-    // add dependencies
-    const QHash<PluginDependency, PluginSpecification *> deps = spec->dependencySpecifications();
-    for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it) {
-        // Skip test dependencies since they are not real dependencies but just force-loaded
-        // plugins when running tests
-        if (it.key().type == PluginDependency::Type::Test)
+    for (PluginSpecification *spec : std::as_const(specs)) {
+        if (spec)
+            m_pluginSpecs.append(spec);
+    }
+    if (cache && !cache->save())
+        qWarning() << "Cannot write plugin metadata cache" << cache->fileName();
+    m_restoredLoadQueue.reset();
+    indexSpecs();
+    if (!restoreStartupSnapshot())
+        resolveDependencies();
+    if (m_pathWatcher)
+        m_pathWatcher->watch(m_pluginPaths);
+    emit pluginsChanged();
+}
+
+// Specs whose library is in use keep the code they loaded and are only marked as
+// outdated, see reloadPlugin(). The others follow their files, and the specs that
+// depend on them by name are resolved again. Nothing else is touched.
+void PluginManager::updatePluginFiles(const QStringList &added,
+                                      const QStringList &changed,
+                                      const QStringList &removed)
+{
+    QSet<QString> changedNames;
+    const auto discard = [this, &changedNames](PluginSpecification *spec) {
+        changedNames.insert(spec->name().toCaseFolded());
+        unlinkSpec(spec);
+        unindexSpec(spec);
+        m_dependents.remove(spec);
+        m_pluginSpecs.removeOne(spec);
+        delete spec;
+    };
+
+    for (const QString &filePath : removed) {
+        PluginSpecification *spec = m_specsByFile.value(filePath);
+        if (!spec)
             continue;
-        PluginSpecification *depSpec = it.value();
-        if (!loadQueue(depSpec, queue, circularityCheckQueue)) {
-            spec->m_errorString =
+        if (isSpecInUse(spec))
+            spec->m_outdated = true;
+        else
+            discard(spec);
+    }
+    QVector<PluginSpecification *> updated;
+    for (const QString &filePath : added + changed) {
+        PluginSpecification *spec = m_specsByFile.value(filePath);
+        if (spec && isSpecInUse(spec)) {
+            spec->m_outdated = true;
+            continue;
+        }
+        if (spec) {
+            changedNames.insert(spec->name().toCaseFolded());
+            unlinkSpec(spec);
+            unindexSpec(spec);
+        } else {
+            spec = new PluginSpecification;
+            m_pluginSpecs.append(spec);
+        }
+        PluginProfiler::Scope profile(m_profiler, ProfilePhase::Read, filePath);
+        if (!spec->read(filePath)) {
+            discard(spec);
+            continue;
+        }
+        profile.setPluginName(spec->name());
+        indexSpec(spec);
+        changedNames.insert(spec->name().toCaseFolded());
+        updated.append(spec);
+    }
+    resolveUpdatedSpecs(updated, changedNames);
+}
+
+// Static plugins registered after loadPlugins() join the specs that are already
+// there, the way rescanned files do. Running plugins and their specs are left alone.
+void PluginManager::addStaticSpecs(const QVector<PluginSpecification *> &specs)
+{
+    if (specs.isEmpty())
+        return;
+    QSet<QString> changedNames;
+    for (PluginSpecification *spec : specs) {
+        m_pluginSpecs.append(spec);
+        indexSpec(spec);
+        changedNames.insert(spec->name().toCaseFolded());
+    }
+    resolveUpdatedSpecs(specs, changedNames);
+}
+
+// Resolves the updated specs, and again the specs depending on one of the changed
+// names, unless they are in use.
+void PluginManager::resolveUpdatedSpecs(const QVector<PluginSpecification *> &updated,
+                                        const QSet<QString> &changedNames)
+{
+    const QSet<PluginSpecification *> updatedSpecs(updated.cbegin(), updated.cend());
+    QSet<PluginSpecification *> unresolved = updatedSpecs;
+    for (const QString &name : std::as_const(changedNames)) {
+        const QVector<PluginSpecification *> dependents = m_dependentsByName.value(name);
+        for (PluginSpecification *dependent : dependents) {
+            if (dependent->state() != PluginState::Invalid && !isSpecInUse(dependent))
+                unresolved.insert(dependent);
+        }
+    }
+    for (PluginSpecification *spec : std::as_const(unresolved)) {
+        if (!updatedSpecs.contains(spec)) {
+            unlinkSpec(spec);
+            spec->unloadLibrary();
+        }
+        spec->resolveDependencies(m_specsByName);
+        for (PluginSpecification *dependency : spec->dependencySpecifications())
+            m_dependents[dependency].append(spec);
+        if (spec->state() != PluginState::Resolved)
+            continue;
+        // brought up when somebody asks for what they provide, or through activatePlugin()
+        QWriteLocker lock(&m_lock);
+        const QStringList &interfaces = spec->interfaces();
+        for (const QString &interfaceName : interfaces)
+            m_lazyInterfaces[interfaceName].append(spec);
+        m_hasLazyInterfaces.store(!m_lazyInterfaces.isEmpty(), std::memory_order_release);
+    }
+    m_restoredLoadQueue.reset();
+    emit pluginsChanged();
+}
+
+bool PluginManager::isSpecInUse(PluginSpecification *spec) const
+{
+    if (spec->plugin() || (spec->m_loader && spec->m_loader->isLoaded()))
+        return true;
+    const QVector<PluginSpecification *> dependents = m_dependents.value(spec);
+    return std::any_of(dependents.cbegin(), dependents.cend(), [](PluginSpecification *dependent) {
+        return dependent->state() > PluginState::Resolved;
+    });
+}
+
+void PluginManager::unlinkSpec(PluginSpecification *spec)
+{
+    for (PluginSpecification *dependency : spec->dependencySpecifications()) {
+        const auto it = m_dependents.find(dependency);
+        if (it != m_dependents.end())
+            it->removeOne(spec);
+    }
+    QWriteLocker lock(&m_lock);
+    const QStringList &interfaces = spec->interfaces();
+    for (const QString &interfaceName : interfaces) {
+        const auto it = m_lazyInterfaces.find(interfaceName);
+        if (it == m_lazyInterfaces.end())
+            continue;
+        it->removeOne(spec);
+        if (it->isEmpty())
+            m_lazyInterfaces.erase(it);
+    }
+}
+
+void PluginManager::resolveDependencies()
+{
+    PluginProfiler::Scope profile(m_profiler, ProfilePhase::ResolveDependencies, QString());
+    for (PluginSpecification *spec : std::as_const(m_pluginSpecs))
+        spec->resolveDependencies(m_specsByName);
+    indexDependents();
+}
+
+void PluginManager::indexSpecs()
+{
+    // one index over all specs makes resolution linear in specs plus dependencies
+    m_specsByName.clear();
+    m_specsByName.reserve(m_pluginSpecs.size());
+    m_specsByFile.clear();
+    m_specsByFile.reserve(m_pluginSpecs.size());
+    m_dependentsByName.clear();
+    for (PluginSpecification *spec : std::as_const(m_pluginSpecs))
+        indexSpec(spec);
+}
+
+void PluginManager::indexSpec(PluginSpecification *spec)
+{
+    m_specsByName[spec->name().toCaseFolded()].append(spec);
+    if (!spec->m_filePath.isEmpty())
+        m_specsByFile.insert(spec->m_filePath, spec);
+    for (const PluginDependency &dependency : spec->dependencies())
+        m_dependentsByName[dependency.name.toCaseFolded()].append(spec);
+}
+
+void PluginManager::unindexSpec(PluginSpecification *spec)
+{
+    const auto remove = [spec](QHash<QString, QVector<PluginSpecification *>> &index,
+                               const QString &name) {
+        const auto it = index.find(name.toCaseFolded());
+        if (it == index.end())
+            return;
+        it->removeOne(spec);
+        if (it->isEmpty())
+            index.erase(it);
+    };
+    remove(m_specsByName, spec->name());
+    if (!spec->m_filePath.isEmpty())
+        m_specsByFile.remove(spec->m_filePath);
+    for (const PluginDependency &dependency : spec->dependencies())
+        remove(m_dependentsByName, dependency.name);
+}
+
+bool PluginManager::restoreStartupSnapshot()
+{
+    if (m_startupSnapshotFile.isEmpty())
+        return false;
+    PluginProfiler::Scope profile(m_profiler, ProfilePhase::ResolveDependencies, QString());
+    PluginStartupSnapshot snapshot(m_startupSnapshotFile);
+    QVector<PluginSpecification *> queue;
+    if (!snapshot.restore(m_pluginSpecs, &queue))
+        return false;
+    m_restoredLoadQueue = queue;
+    indexDependents();
+    return true;
+}
+
+void PluginManager::indexDependents()
+{
+    m_dependents.clear();
+    for (PluginSpecification *spec : std::as_const(m_pluginSpecs)) {
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
+        for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it)
+            m_dependents[it.value()].append(spec);
+    }
+}
+
+// marks for specs that are no longer on the traversal path; specs on the path
+// are marked with their index in it
+constexpr qsizetype kQueuedMark = -1;
+constexpr qsizetype kFailedMark = -2;
+
+// path is empty again on return, callers pass the same one for all specs of a
+// traversal so that its storage is reused
+bool PluginManager::loadQueue(PluginSpecification *spec,
+                              QVector<PluginSpecification *> &queue,
+                              QHash<PluginSpecification *, qsizetype> &marks,
+                              QVector<LoadQueueFrame> &path)
+{
+
+    // Returns the result for specs that are already decided, otherwise puts the spec on the path.
+    const auto visit = [&path, &queue, &marks](PluginSpecification *spec) -> std::optional<bool> {
+        const auto it = marks.constFind(spec);
+        if (it != marks.cend()) {
+            if (*it == kQueuedMark)
+                return true;
+            if (*it == kFailedMark)
+                return false;
+            // check for circular dependencies
+            spec->m_errorString = Tr::tr("Circular dependency detected:");
+            spec->m_errorString.value() += QLatin1Char('\n');
+            for (qsizetype i = *it; i < path.size(); ++i) {
+                const PluginSpecification *depSpec = path.at(i).spec;
+                spec->m_errorString.value().append(Tr::tr("%1 (%2) depends on")
+                                                       .arg(depSpec->name(), depSpec->version()));
+                spec->m_errorString.value() += QLatin1Char('\n');
+            }
+            spec->m_errorString.value().append(Tr::tr("%1 (%2)").arg(spec->name(), spec->version()));
+            return false;
+        }
+        // check if we have the dependencies
+        if (spec->state() == PluginState::Invalid || spec->state() == PluginState::Read) {
+            queue.append(spec);
+            marks.insert(spec, kFailedMark);
+            return false;
+        }
+        marks.insert(spec, path.size());
+        path.append({spec, 0, nullptr});
+        return std::nullopt;
+    };
+
+    std::optional<bool> result = visit(spec);
+    while (!path.isEmpty()) {
+        const qsizetype top = path.size() - 1;
+        PluginSpecification *current = path.at(top).spec;
+        if (result && !*result) {
+            const PluginSpecification *depSpec = path.at(top).pendingDependency;
+            current->m_errorString =
                 Tr::tr("Cannot load plugin because dependency failed to load: %1 (%2)\nReason: %3")
                     .arg(depSpec->name(), depSpec->version(), depSpec->errorString().value_or(""));
-            return false;
+            marks.insert(current, kFailedMark);
+            path.removeLast();
+            continue;
+        }
+        result.reset();
+
+        // add dependencies
+        const QVector<PluginDependency> &deps = current->dependencies();
+        PluginSpecification *depSpec = nullptr;
+        qsizetype next = path.at(top).nextDependency;
+        for (; next < deps.size() && !depSpec; ++next) {
+            // Skip test dependencies since they are not real dependencies but just force-loaded
+            // plugins when running tests
+            if (deps.at(next).type == PluginDependency::Type::Test)
+                continue;
+            depSpec = current->dependencySpecifications().value(deps.at(next));
+        }
+        if (depSpec) {
+            path[top].nextDependency = next;
+            path[top].pendingDependency = depSpec;
+            result = visit(depSpec);
+            continue;
         }
+
+        // add self
+        marks.insert(current, kQueuedMark);
+        queue.append(current);
+        path.removeLast();
+        result = true;
     }
-    // add self
-    queue.append(spec);
-    return true;
+    return *result;
 }
 
 static inline QString getPlatformName()
@@ -67,49 +461,77 @@ static inline QString getPlatformName()
     return QLatin1String("Unknown");
 }
 
-QString PluginManager::platformName()
+const QString &PluginManager::platformName()
 {
     static const QString result = getPlatformName() + " (" + QSysInfo::prettyProductName() + ')';
     return result;
 }
 
-void PluginManager::loadPlugin(PluginSpecification *spec, PluginState destState)
+bool PluginManager::prepareTransition(PluginSpecification *spec, PluginState destState)
 {
     if (spec->hasError() || spec->state() != destState-1)
-        return;
+        return false;
 
     // don't load disabled plugins.
     if (!spec->isEffectivelyEnabled() && destState == PluginState::Loaded)
-        return;
-
-
-    const std::string specName = spec->name().toStdString();
+        return false;
 
-    switch (destState) {
-    case PluginState::Running: {
-        spec->initializeExtensions();
-        return;
-    }
-    case PluginState::Deleted:
-        spec->kill();
-        return;
-    default:
-        break;
+    if (destState == PluginState::Running || destState == PluginState::Stopped
+        || destState == PluginState::Deleted) {
+        return true;
     }
+
     // check if dependencies have loaded without error
-    const QHash<PluginDependency, PluginSpecification *> deps = spec->dependencySpecifications();
+    const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
     for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it) {
         if (it.key().type != PluginDependency::Type::Required)
             continue;
         PluginSpecification *depSpec = it.value();
-        if (depSpec->state() != destState) {
+        // Libraries are loaded and initialized one spec at a time, so a dependency may
+        // already be further along than destState.
+        if (depSpec->state() < destState || depSpec->state() > PluginState::Running) {
             spec->m_errorString =
                 Tr::tr("Cannot load plugin because dependency failed to load: %1(%2)\nReason: %3")
                     .arg(depSpec->name(), depSpec->version(), depSpec->errorString().value_or(""));
-            return;
+            return false;
         }
     }
+    return true;
+}
+
+static ProfilePhase profilePhase(PluginState destState)
+{
     switch (destState) {
+    case PluginState::Loaded:
+        return ProfilePhase::LoadLibrary;
+    case PluginState::Initialized:
+        return ProfilePhase::Initialize;
+    case PluginState::Running:
+        return ProfilePhase::ExtensionsInitialized;
+    case PluginState::Stopped:
+        return ProfilePhase::Stop;
+    case PluginState::Deleted:
+        return ProfilePhase::Delete;
+    default:
+        return ProfilePhase::ResolveQueue;
+    }
+}
+
+void PluginManager::loadPlugin(PluginSpecification *spec, PluginState destState)
+{
+    if (!prepareTransition(spec, destState))
+        return;
+
+    PluginProfiler::Scope profile(m_profiler, profilePhase(destState), spec->name());
+
+    switch (destState) {
+    case PluginState::Running: {
+        spec->initializeExtensions();
+        return;
+    }
+    case PluginState::Deleted:
+        spec->kill();
+        return;
     case PluginState::Loaded: {
         spec->loadLibrary();
         break;
@@ -119,34 +541,330 @@ void PluginManager::loadPlugin(PluginSpecification *spec, PluginState destState)
         break;
     }
     case PluginState::Stopped:
-        if (spec->stop() == PluginShutdownFlag::AsynchronousShutdown) {
+        if (!spec->plugin())
+            break;
+        watchAsynchronousShutdown(spec);
+        if (spec->stop() == PluginShutdownFlag::AsynchronousShutdown)
             m_asynchronousPlugins << spec;
-            connect(spec->plugin(), &IPlugin::asynchronousShutdownFinished, this, [this, spec] {
-                m_asynchronousPlugins.remove(spec);
-                if (m_asynchronousPlugins.isEmpty())
-                    m_shutdownEventLoop->exit();
-            });
-        }
         break;
     default:
         break;
     }
 }
 
-void PluginManager::startDelayedInitialize()
+void PluginManager::watchAsynchronousShutdown(PluginSpecification *spec)
 {
+    // Queued, so that a plugin finishing before (or while) aboutToShutdown() returns is
+    // only seen once it is in m_asynchronousPlugins, and so that it can finish from any thread.
+    connect(spec->plugin(), &IPlugin::asynchronousShutdownFinished, this, [this, spec] {
+        m_asynchronousPlugins.remove(spec);
+        if (m_asynchronousPlugins.isEmpty() && m_shutdownEventLoop)
+            m_shutdownEventLoop->exit();
+    }, Qt::QueuedConnection);
+}
+
+void PluginManager::initializePluginsInParallel(const QVector<PluginSpecification *> &queue)
+{
+    // A spec becomes ready once every dependency that precedes it in the queue has finished
+    // its initialization attempt, successful or not. Failures are then reported by the usual
+    // dependency check in prepareTransition().
+    QHash<PluginSpecification *, int> pendingDependencies;
+    QHash<PluginSpecification *, QVector<PluginSpecification *>> dependents;
+    pendingDependencies.reserve(queue.size());
+    for (PluginSpecification *spec : queue)
+        pendingDependencies.insert(spec, 0);
+    for (PluginSpecification *spec : queue) {
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
+        for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it) {
+            if (it.key().type == PluginDependency::Type::Test
+                || !pendingDependencies.contains(it.value())) {
+                continue;
+            }
+            ++pendingDependencies[spec];
+            dependents[it.value()].append(spec);
+        }
+    }
+
+    QQueue<PluginSpecification *> ready;
+    for (PluginSpecification *spec : queue) {
+        if (pendingDependencies.value(spec) == 0)
+            ready.enqueue(spec);
+    }
+
+    QQueue<PluginSpecification *> finished;
     {
-        while (!m_delayedInitializeQueue.empty()) {
-            PluginSpecification *spec = m_delayedInitializeQueue.front();
-            const std::string specName = spec->name().toStdString();
-            m_delayedInitializeQueue.dequeue();
-            bool delay = spec->delayedInitialize();
-            if (delay)
-                QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+        QMutexLocker locker(&m_workerMutex);
+        ++m_waitingForWorkers;
+    }
+    QThreadPool pool;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    qsizetype running = 0;
+
+    const auto finish = [&pendingDependencies, &dependents, &ready](PluginSpecification *spec) {
+        for (PluginSpecification *dependent : dependents.value(spec)) {
+            if (--pendingDependencies[dependent] == 0)
+                ready.enqueue(dependent);
+        }
+    };
+
+    while (true) {
+        while (!ready.isEmpty()) {
+            PluginSpecification *spec = ready.dequeue();
+            waitForLibrary(spec);
+            loadPlugin(spec, PluginState::Loaded);
+            if (spec->isThreadSafeInitialize() && prepareTransition(spec, PluginState::Initialized)) {
+                ++running;
+                pool.start([this, spec, &finished] {
+                    {
+                        PluginProfiler::Scope profile(m_profiler,
+                                                      ProfilePhase::Initialize,
+                                                      spec->name());
+                        spec->initializePlugin();
+                    }
+                    QMutexLocker locker(&m_workerMutex);
+                    finished.enqueue(spec);
+                    m_workerEvent.wakeAll();
+                });
+            } else {
+                loadPlugin(spec, PluginState::Initialized);
+                finish(spec);
+            }
+        }
+        if (running == 0)
+            break;
+
+        // Workers that need the main thread, e.g. to activate a lazy plugin, cannot
+        // use queued calls while it waits here, it runs their calls instead.
+        QQueue<PluginSpecification *> done;
+        QQueue<WorkerCall> calls;
+        {
+            QMutexLocker locker(&m_workerMutex);
+            while (finished.isEmpty() && m_workerCalls.isEmpty())
+                m_workerEvent.wait(&m_workerMutex);
+            done.swap(finished);
+            calls.swap(m_workerCalls);
         }
-        m_isInitializationDone = true;
+        runWorkerCalls(calls);
+        running -= done.size();
+        for (PluginSpecification *spec : std::as_const(done))
+            finish(spec);
     }
+
+    QQueue<WorkerCall> calls;
+    {
+        QMutexLocker locker(&m_workerMutex);
+        if (--m_waitingForWorkers == 0)
+            calls.swap(m_workerCalls);
+    }
+    runWorkerCalls(calls);
+}
+
+void PluginManager::runWorkerCalls(const QQueue<WorkerCall> &calls)
+{
+    for (const WorkerCall &call : calls) {
+        call.function();
+        QMutexLocker locker(&m_workerMutex);
+        *call.done = true;
+        m_workerCallDone.wakeAll();
+    }
+}
+
+void PluginManager::callOnMainThread(const std::function<void()> &function)
+{
+    {
+        QMutexLocker locker(&m_workerMutex);
+        if (m_waitingForWorkers > 0) {
+            bool done = false;
+            m_workerCalls.enqueue({function, &done});
+            m_workerEvent.wakeAll();
+            while (!done)
+                m_workerCallDone.wait(&m_workerMutex);
+            return;
+        }
+    }
+    QMetaObject::invokeMethod(this, function, Qt::BlockingQueuedConnection);
+}
+
+void PluginManager::preloadLibraries(const QVector<PluginSpecification *> &queue)
+{
+    QVector<PluginSpecification *> libraries;
+    for (PluginSpecification *spec : queue) {
+        if (spec->hasError() || spec->state() != PluginState::Resolved || spec->isStaticPlugin()
+            || !spec->isEffectivelyEnabled()) {
+            continue;
+        }
+        libraries.append(spec);
+    }
+    if (libraries.isEmpty())
+        return;
+
+    // One sequential reader hands the libraries to the kernel's readahead in queue
+    // order, so that the loaders' page faults hit the page cache instead of the disk.
+    // A loader waits until its library has been handed over, which is quick since
+    // fadvise only queues the reads, and keeps the reader ahead of the loaders.
+    struct PrefetchProgress
+    {
+        QMutex mutex;
+        QWaitCondition advanced;
+        qsizetype count = 0;
+    };
+    std::shared_ptr<PrefetchProgress> progress;
+    if (m_libraryPrefetch) {
+        progress = std::make_shared<PrefetchProgress>();
+        m_prefetchPool.setMaxThreadCount(1);
+        m_prefetchPool.start([this, libraries, progress] {
+            for (PluginSpecification *spec : libraries) {
+                {
+                    PluginProfiler::Scope scope(m_profiler, ProfilePhase::Prefetch, spec->name());
+                    prefetchLibrary(spec->m_filePath);
+                }
+                QMutexLocker locker(&progress->mutex);
+                ++progress->count;
+                progress->advanced.wakeAll();
+            }
+        });
+    }
+
+    m_libraryPool.setMaxThreadCount(QThread::idealThreadCount());
+    QThread *ownerThread = thread();
+    // the pool runs tasks in submission order, so libraries come in ahead of the
+    // queue entries that need them
+    for (qsizetype i = 0; i < libraries.size(); ++i) {
+        PluginSpecification *spec = libraries.at(i);
+        {
+            QMutexLocker locker(&m_libraryMutex);
+            m_preloadingLibraries.insert(spec);
+        }
+        m_libraryPool.start([this, spec, ownerThread, progress, i] {
+            if (progress) {
+                QMutexLocker locker(&progress->mutex);
+                while (progress->count <= i)
+                    progress->advanced.wait(&progress->mutex);
+            }
+            spec->preloadLibrary(ownerThread);
+            QMutexLocker locker(&m_libraryMutex);
+            m_preloadingLibraries.remove(spec);
+            m_libraryPreloaded.wakeAll();
+        });
+    }
+}
+
+void PluginManager::waitForLibrary(PluginSpecification *spec)
+{
+    QMutexLocker locker(&m_libraryMutex);
+    while (m_preloadingLibraries.contains(spec))
+        m_libraryPreloaded.wait(&m_libraryMutex);
+}
+
+void PluginManager::finishLibraryPreloading(const QVector<PluginSpecification *> &queue)
+{
+    m_libraryPool.waitForDone();
+    m_prefetchPool.waitForDone();
+    // libraries of specs that never got loaded, e.g. because a dependency failed
+    for (PluginSpecification *spec : queue) {
+        if (spec->state() == PluginState::Resolved && spec->m_loader && spec->m_loader->isLoaded())
+            spec->m_loader->unload();
+    }
+}
+
+void PluginManager::enqueueDelayedInitialize(PluginSpecification *spec)
+{
+    m_delayedInitializeQueue[spec->delayedInitializePriority()].enqueue(spec);
+}
+
+void PluginManager::scheduleDelayedInitialize(int interval)
+{
+    m_delayedInitializeDue = m_delayedInitializeClock.elapsed() + interval;
+    m_delayedInitializeTimer.start(interval);
+}
+
+void PluginManager::startDelayedInitialize()
+{
+    // how late the timer fired is how long other events kept the event loop busy
+    const qint64 sliceStart = m_delayedInitializeClock.elapsed();
+    const qint64 latency = qMax<qint64>(0, sliceStart - m_delayedInitializeDue);
+
+    // Every slice runs at least one plugin and ends once the budget is used up, or
+    // right away when a plugin reports that it did substantial work.
+    while (!m_delayedInitializeQueue.empty()) {
+        const auto bucket = m_delayedInitializeQueue.begin();
+        PluginSpecification *spec = bucket->second.dequeue();
+        if (bucket->second.isEmpty())
+            m_delayedInitializeQueue.erase(bucket);
+        bool delay = false;
+        {
+            PluginProfiler::Scope profile(m_profiler,
+                                          ProfilePhase::DelayedInitialize,
+                                          spec->name());
+            delay = spec->delayedInitialize();
+        }
+        if (delay || m_delayedInitializeClock.elapsed() - sliceStart >= m_delayedInitializeBudget)
+            break;
+    }
+
+    const qint64 sliceDuration = m_delayedInitializeClock.elapsed() - sliceStart;
+    ++m_delayedInitializeStatistics.slices;
+    m_delayedInitializeStatistics.worstSlice = qMax(m_delayedInitializeStatistics.worstSlice,
+                                                    sliceDuration);
+    m_delayedInitializeStatistics.worstLatency = qMax(m_delayedInitializeStatistics.worstLatency,
+                                                      latency);
+    if (!m_delayedInitializeQueue.empty()) {
+        // back off while slices overrun their budget or the event loop lags behind
+        const qint64 overrun = qMax<qint64>(0, sliceDuration - m_delayedInitializeBudget);
+        scheduleDelayedInitialize(int(qMin<qint64>(overrun + latency, kMaxDelayedInitializeInterval)));
+        return;
+    }
+    // activated lazy plugins come through here again later
+    if (m_isInitializationDone)
+        return;
+    m_isInitializationDone = true;
     emit initializationDone();
+    if (m_profiler.isEnabled())
+        reportProfile();
+}
+
+void PluginManager::setDelayedInitializeBudget(int msecs)
+{
+    m_delayedInitializeBudget = qMax(0, msecs);
+}
+
+int PluginManager::delayedInitializeBudget() const
+{
+    return m_delayedInitializeBudget;
+}
+
+DelayedInitializeStatistics PluginManager::delayedInitializeStatistics() const
+{
+    DelayedInitializeStatistics statistics = m_delayedInitializeStatistics;
+    for (const auto &bucket : m_delayedInitializeQueue)
+        statistics.queueDepth += bucket.second.size();
+    return statistics;
+}
+
+void PluginManager::reportProfile()
+{
+    qInfo().noquote() << "Plugin startup profile:\n" + m_profiler.summary();
+    const qint64 uptime = PluginProfiler::processUptime();
+    if (uptime >= 0) {
+        qInfo().nospace() << "Cold start: " << double(uptime) / 1000000.0
+                          << " ms since process start, " << PluginProfiler::processMajorFaults()
+                          << " major faults";
+    } else {
+        qInfo().nospace() << "Startup: " << double(m_profiler.now()) / 1000000.0
+                          << " ms since the plugin manager was created, "
+                          << PluginProfiler::processMajorFaults() << " major faults";
+    }
+    qInfo().nospace() << "Delayed initialization: " << m_delayedInitializeStatistics.slices
+                      << " slices, worst slice " << m_delayedInitializeStatistics.worstSlice
+                      << " ms, worst event loop latency "
+                      << m_delayedInitializeStatistics.worstLatency << " ms";
+    if (!m_profileTraceFile.isEmpty() && !m_profiler.writeChromeTrace(m_profileTraceFile))
+        qWarning() << "Cannot write plugin startup trace" << m_profileTraceFile;
+}
+
+PluginProfiler &PluginManager::profiler()
+{
+    return m_profiler;
 }
 
 Utils::Settings *PluginManager::settings() const
@@ -170,7 +888,7 @@ PluginManager &PluginManager::instance()
     return m_instance;
 }
 
-QString PluginManager::pluginIID() const
+const QString &PluginManager::pluginIID() const
 {
     return m_pluginIID;
 }
@@ -180,6 +898,133 @@ void PluginManager::setPluginIID(const QString &newPluginIID)
     m_pluginIID = newPluginIID;
 }
 
+// Reads all specs again, like setStaticPlugins(). Files that change later in the
+// paths are picked up by the watcher instead.
+void PluginManager::setPluginPaths(const QStringList &paths)
+{
+    if (m_pluginsLoaded) {
+        qWarning() << "Cannot replace plugin paths while plugins are loaded";
+        return;
+    }
+    m_pluginPaths = paths;
+    readPluginPaths();
+}
+
+QStringList PluginManager::pluginPaths() const
+{
+    return m_pluginPaths;
+}
+
+// Replaces the static plugins and reads all specs again, which would delete the
+// specs of running plugins. Use registerStaticPlugins() once plugins are loaded.
+void PluginManager::setStaticPlugins(const QVector<QStaticPlugin> &plugins)
+{
+    if (m_pluginsLoaded) {
+        qWarning() << "Cannot replace static plugins while plugins are loaded";
+        return;
+    }
+    m_staticPlugins = plugins;
+    readPluginPaths();
+}
+
+QVector<QStaticPlugin> PluginManager::staticPlugins() const
+{
+    return m_staticPlugins;
+}
+
+// Every plugin linked into the application with a matching IID becomes a spec, the
+// others (e.g. Qt's own static plugins) are skipped while reading. Like
+// registerStaticPluginMetaData() this only adds what is not registered yet. Before
+// loadPlugins() all specs are read again, which takes the startup snapshot into
+// account; afterwards only the new ones are read, next to the running plugins.
+void PluginManager::registerStaticPlugins()
+{
+    QSet<quintptr> registered;
+    registered.reserve(m_staticPlugins.size());
+    for (const QStaticPlugin &plugin : std::as_const(m_staticPlugins))
+        registered.insert(reinterpret_cast<quintptr>(plugin.instance));
+
+    QVector<QStaticPlugin> added;
+    const QVector<QStaticPlugin> plugins = QPluginLoader::staticPlugins();
+    for (const QStaticPlugin &plugin : plugins) {
+        const quintptr instance = reinterpret_cast<quintptr>(plugin.instance);
+        if (registered.contains(instance))
+            continue;
+        registered.insert(instance);
+        added.append(plugin);
+    }
+    if (added.isEmpty())
+        return;
+    m_staticPlugins += added;
+    if (!m_pluginsLoaded) {
+        readPluginPaths();
+        return;
+    }
+    QVector<PluginSpecification *> specs;
+    for (const QStaticPlugin &plugin : std::as_const(added)) {
+        auto spec = std::make_unique<PluginSpecification>();
+        if (spec->read(plugin))
+            specs.append(spec.release());
+    }
+    addStaticSpecs(specs);
+}
+
+void PluginManager::addStaticPluginMetaData(const QVector<const StaticPluginMetaData *> &metaData)
+{
+    QSet<const StaticPluginMetaData *> registered(m_staticMetaData.cbegin(), m_staticMetaData.cend());
+    QVector<const StaticPluginMetaData *> added;
+    for (const StaticPluginMetaData *data : metaData) {
+        if (registered.contains(data))
+            continue;
+        registered.insert(data);
+        added.append(data);
+    }
+    if (added.isEmpty())
+        return;
+    m_staticMetaData += added;
+    if (!m_pluginsLoaded) {
+        readPluginPaths();
+        return;
+    }
+    QVector<PluginSpecification *> specs;
+    for (const StaticPluginMetaData *data : std::as_const(added)) {
+        auto spec = std::make_unique<PluginSpecification>();
+        if (spec->read(*data))
+            specs.append(spec.release());
+    }
+    addStaticSpecs(specs);
+}
+
+const QVector<PluginSpecification *> &PluginManager::plugins() const
+{
+    return m_pluginSpecs;
+}
+
+QVector<PluginSpecification *> PluginManager::dependents(PluginSpecification *spec) const
+{
+    return m_dependents.value(spec);
+}
+
+void PluginManager::setMetaDataCacheFile(const QString &fileName)
+{
+    m_metaDataCacheFile = fileName;
+}
+
+QString PluginManager::metaDataCacheFile() const
+{
+    return m_metaDataCacheFile;
+}
+
+void PluginManager::setStartupSnapshotFile(const QString &fileName)
+{
+    m_startupSnapshotFile = fileName;
+}
+
+QString PluginManager::startupSnapshotFile() const
+{
+    return m_startupSnapshotFile;
+}
+
 void PluginManager::addObject(QObject *obj)
 {
     {
@@ -187,12 +1032,35 @@ void PluginManager::addObject(QObject *obj)
         if (obj == nullptr) {
             return;
         }
-        if (m_allObjects.contains(obj)) {
+
+        // index the object under every class it derives from and every interface
+        // that has been found so far
+        ObjectEntry entry;
+        for (const QMetaObject *metaObject = obj->metaObject(); metaObject;
+             metaObject = metaObject->superClass()) {
+            entry.keys.append(QByteArray(metaObject->className()));
+        }
+        for (const QByteArray &key : std::as_const(m_interfaceKeys)) {
+            if (!entry.keys.contains(key) && obj->qt_metacast(key.constData()))
+                entry.keys.append(key);
+        }
+        QMutexLocker poolLocker(&m_objectPoolMutex);
+        if (m_objects.contains(obj)) {
             return;
         }
-
-
-        m_allObjects.append(obj);
+        for (const QByteArray &key : std::as_const(entry.keys))
+            m_objectPoolState.index[key].append(obj);
+        m_objectPoolState.objects.append(obj);
+        m_objectPoolStale.store(true, std::memory_order_release);
+        // Destroyed objects are dropped from the pool instead of lingering as null
+        // pointers. Only m_objectPoolMutex is taken for that: the destructor may run
+        // while its thread holds listLock().
+        entry.destroyedConnection = connect(obj, &QObject::destroyed, this,
+                                            [this](QObject *destroyed) {
+                                                unindexObject(destroyed);
+                                            },
+                                            Qt::DirectConnection);
+        m_objects.insert(obj, entry);
     }
     emit objectAdded(obj);
 }
@@ -204,18 +1072,99 @@ void PluginManager::removeObject(QObject *obj)
         return;
     }
 
-    if (!m_allObjects.contains(obj)) {
-        return;
+    {
+        QMutexLocker poolLocker(&m_objectPoolMutex);
+        if (!m_objects.contains(obj)) {
+            return;
+        }
     }
 
     emit aboutToRemoveObject(obj);
     QWriteLocker lock(&m_lock);
-    m_allObjects.removeAll(obj);
+    unindexObject(obj);
+}
+
+void PluginManager::unindexObject(QObject *obj)
+{
+    QMutexLocker poolLocker(&m_objectPoolMutex);
+    const auto it = m_objects.constFind(obj);
+    if (it == m_objects.cend())
+        return;
+    disconnect(it->destroyedConnection);
+    for (const QByteArray &key : it->keys)
+        m_objectPoolState.index[key].removeOne(obj);
+    m_objectPoolState.objects.removeIf([obj](const QPointer<QObject> &candidate) {
+        return candidate.isNull() || candidate == obj;
+    });
+    m_objectPoolStale.store(true, std::memory_order_release);
+    m_objects.erase(it);
 }
 
 QVector<QPointer<QObject> > PluginManager::allObjects()
 {
-    return m_allObjects;
+    return objectPoolSnapshot()->objects;
+}
+
+// Writers change m_objectPoolState in place and only mark the published snapshot as
+// stale, the first reader after them publishes a copy. The copy shares its data with
+// the state, so it costs nothing until the next write detaches the state again: a
+// burst of writes without reads in between copies the pool once, not once per write.
+std::shared_ptr<const ObjectPoolSnapshot> PluginManager::objectPoolSnapshot() const
+{
+    if (m_objectPoolStale.load(std::memory_order_acquire)) {
+        QMutexLocker poolLocker(&m_objectPoolMutex);
+        if (m_objectPoolStale.load(std::memory_order_relaxed)) {
+            m_objectPool.store(std::make_shared<const ObjectPoolSnapshot>(m_objectPoolState),
+                               std::memory_order_release);
+            m_objectPoolStale.store(false, std::memory_order_release);
+        }
+    }
+    return m_objectPool.load(std::memory_order_acquire);
+}
+
+QObject *PluginManager::getObjectByInterface(const QString &interfaceName)
+{
+    const QVector<QObject *> objects = objectsForKey(interfaceName.toLatin1());
+    return objects.isEmpty() ? nullptr : objects.first();
+}
+
+QVector<QObject *> PluginManager::getObjectsByInterface(const QString &interfaceName)
+{
+    return objectsForKey(interfaceName.toLatin1());
+}
+
+QVector<QObject *> PluginManager::objectsForKey(const QByteArray &key)
+{
+    if (m_hasLazyInterfaces.load(std::memory_order_acquire))
+        activatePluginsProviding(QString::fromLatin1(key));
+    {
+        const std::shared_ptr<const ObjectPoolSnapshot> pool = objectPoolSnapshot();
+        const auto it = pool->index.constFind(key);
+        if (it != pool->index.cend())
+            return *it;
+    }
+
+    // First lookup of an interface IID (or of a class nothing was registered for yet):
+    // scan the pool and, if something matches, keep the key indexed from now on.
+    QWriteLocker lock(&m_lock);
+    QMutexLocker poolLocker(&m_objectPoolMutex);
+    const auto it = m_objectPoolState.index.constFind(key);
+    if (it != m_objectPoolState.index.cend())
+        return *it;
+    QVector<QObject *> objects;
+    for (const QPointer<QObject> &obj : std::as_const(m_objectPoolState.objects)) {
+        if (obj && obj->qt_metacast(key.constData()))
+            objects.append(obj);
+    }
+    // Misses are not kept, every object added later would be tested against them.
+    if (objects.isEmpty())
+        return objects;
+    for (QObject *obj : std::as_const(objects))
+        m_objects[obj].keys.append(key);
+    m_objectPoolState.index.insert(key, objects);
+    m_interfaceKeys.insert(key);
+    m_objectPoolStale.store(true, std::memory_order_release);
+    return objects;
 }
 
 QReadWriteLock *PluginManager::listLock()
@@ -225,41 +1174,483 @@ QReadWriteLock *PluginManager::listLock()
 
 void PluginManager::loadPlugins()
 {
+    m_pluginsLoaded = true;
+    const QVector<PluginSpecification *> loadOrder = loadQueue();
+    if (!m_restoredLoadQueue && !m_startupSnapshotFile.isEmpty()) {
+        // written before any plugin runs, later failures are not part of resolution
+        PluginStartupSnapshot snapshot(m_startupSnapshotFile);
+        if (snapshot.save(m_pluginSpecs, loadOrder))
+            m_restoredLoadQueue = loadOrder;
+    }
+    const QVector<PluginSpecification *> queue = startupQueue(loadOrder);
+    startPlugins(queue);
+    emit pluginsChanged();
 
-    const QVector<PluginSpecification *> queue = loadQueue();
+    scheduleDelayedInitialize(kDelayedInitializeInterval);
+}
 
-    for (PluginSpecification *spec : queue)
-        loadPlugin(spec, PluginState::Initialized);
+void PluginManager::clearLazyInterfaces()
+{
+    QWriteLocker lock(&m_lock);
+    m_lazyInterfaces.clear();
+    m_hasLazyInterfaces.store(false, std::memory_order_release);
+}
+
+QVector<PluginSpecification *> PluginManager::startupQueue(const QVector<PluginSpecification *> &queue)
+{
+    // Lazy plugins stay Resolved until they are activated, unless a plugin that is
+    // started right away depends on them.
+    QSet<PluginSpecification *> started;
+    Utils::reverseForeach(queue, [&started](PluginSpecification *spec) {
+        if (spec->isLazy() && !started.contains(spec))
+            return;
+        started.insert(spec);
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
+        for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it) {
+            if (it.key().type != PluginDependency::Type::Test)
+                started.insert(it.value());
+        }
+    });
+
+    QVector<PluginSpecification *> result;
+    QWriteLocker lock(&m_lock);
+    m_lazyInterfaces.clear();
+    for (PluginSpecification *spec : queue) {
+        if (started.contains(spec)) {
+            result.append(spec);
+            continue;
+        }
+        const QStringList &interfaces = spec->interfaces();
+        for (const QString &interfaceName : interfaces)
+            m_lazyInterfaces[interfaceName].append(spec);
+    }
+    m_hasLazyInterfaces.store(!m_lazyInterfaces.isEmpty(), std::memory_order_release);
+    return result;
+}
+
+void PluginManager::startPlugins(const QVector<PluginSpecification *> &queue)
+{
+    preloadLibraries(queue);
+    if (m_parallelInitialization) {
+        initializePluginsInParallel(queue);
+    } else {
+        for (PluginSpecification *spec : queue) {
+            waitForLibrary(spec);
+            loadPlugin(spec, PluginState::Loaded);
+            loadPlugin(spec, PluginState::Initialized);
+        }
+    }
+    finishLibraryPreloading(queue);
 
     {
         Utils::reverseForeach(queue, [this](PluginSpecification *spec) {
             loadPlugin(spec, PluginState::Running);
             if (spec->state() == PluginState::Running) {
-                m_delayedInitializeQueue.enqueue(spec);
+                enqueueDelayedInitialize(spec);
             } else {
                 // Plugin initialization failed, so cleanup after it
                 spec->kill();
             }
         });
     }
+}
+
+void PluginManager::shutdown()
+{
+    // lookups made while plugins go down must not bring up lazy ones
+    clearLazyInterfaces();
+    m_delayedInitializeTimer.stop();
+    m_delayedInitializeQueue.clear();
+    m_libraryPool.waitForDone();
+    m_prefetchPool.waitForDone();
+
+    const QVector<PluginSpecification *> queue = loadQueue();
+    const QDeadlineTimer deadline(m_shutdownTimeout);
+    const QVector<QVector<PluginSpecification *>> levels = shutdownLevels(queue);
+    for (const QVector<PluginSpecification *> &level : levels) {
+        stopPlugins(level);
+        waitForAsynchronousShutdown(deadline);
+    }
+    Utils::reverseForeach(queue, [this](PluginSpecification *spec) {
+        loadPlugin(spec, PluginState::Deleted);
+    });
+    if (m_settings)
+        m_settings->flush();
+    m_pluginsLoaded = false;
     emit pluginsChanged();
+}
 
-    m_delayedInitializeTimer.setInterval(kDelayedInitializeInterval);
-    m_delayedInitializeTimer.setSingleShot(true);
-    connect(&m_delayedInitializeTimer,
-            &QTimer::timeout,
+QVector<QVector<PluginSpecification *>> PluginManager::shutdownLevels(
+    const QVector<PluginSpecification *> &queue) const
+{
+    // A spec's level is the length of the longest chain of specs depending on it, so
+    // every level only depends on the levels after it. The queue has dependencies
+    // ahead of their dependents, walking it backwards settles each level before it is read.
+    QHash<PluginSpecification *, int> levelOf;
+    levelOf.reserve(queue.size());
+    int levelCount = 0;
+    Utils::reverseForeach(queue, [&levelOf, &levelCount](PluginSpecification *spec) {
+        const int level = levelOf.value(spec, 0);
+        if (spec->state() == PluginState::Running)
+            levelCount = qMax(levelCount, level + 1);
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->dependencySpecifications();
+        for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it) {
+            if (it.key().type == PluginDependency::Type::Test)
+                continue;
+            int &depLevel = levelOf[it.value()];
+            depLevel = qMax(depLevel, level + 1);
+        }
+    });
+
+    QVector<QVector<PluginSpecification *>> levels(levelCount);
+    for (PluginSpecification *spec : queue) {
+        if (spec->state() == PluginState::Running)
+            levels[levelOf.value(spec, 0)].append(spec);
+    }
+    return levels;
+}
+
+void PluginManager::stopPlugins(const QVector<PluginSpecification *> &level)
+{
+    // Plugins of one level do not depend on each other. Those that declare a thread-safe
+    // shutdown stop on the pool while the others stop here.
+    {
+        QMutexLocker locker(&m_workerMutex);
+        ++m_waitingForWorkers;
+    }
+    QThreadPool pool;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    QVector<PluginSpecification *> asynchronous;
+    qsizetype running = 0;
+    qsizetype finished = 0;
+    for (PluginSpecification *spec : level) {
+        if (!spec->isThreadSafeShutdown() || !spec->plugin()) {
+            loadPlugin(spec, PluginState::Stopped);
+            continue;
+        }
+        if (!prepareTransition(spec, PluginState::Stopped))
+            continue;
+        watchAsynchronousShutdown(spec);
+        ++running;
+        pool.start([this, spec, &asynchronous, &finished] {
+            PluginShutdownFlag flag;
+            {
+                PluginProfiler::Scope profile(m_profiler, ProfilePhase::Stop, spec->name());
+                flag = spec->stop();
+            }
+            QMutexLocker locker(&m_workerMutex);
+            if (flag == PluginShutdownFlag::AsynchronousShutdown)
+                asynchronous.append(spec);
+            ++finished;
+            m_workerEvent.wakeAll();
+        });
+    }
+
+    // as in initializePluginsInParallel(), calls that need the main thread run here
+    bool isDone = false;
+    while (!isDone) {
+        QQueue<WorkerCall> calls;
+        {
+            QMutexLocker locker(&m_workerMutex);
+            while (finished < running && m_workerCalls.isEmpty())
+                m_workerEvent.wait(&m_workerMutex);
+            calls.swap(m_workerCalls);
+            isDone = finished == running;
+        }
+        runWorkerCalls(calls);
+    }
+    pool.waitForDone();
+
+    QQueue<WorkerCall> calls;
+    {
+        QMutexLocker locker(&m_workerMutex);
+        if (--m_waitingForWorkers == 0)
+            calls.swap(m_workerCalls);
+    }
+    runWorkerCalls(calls);
+    for (PluginSpecification *spec : std::as_const(asynchronous))
+        m_asynchronousPlugins << spec;
+}
+
+void PluginManager::waitForAsynchronousShutdown(const QDeadlineTimer &deadline)
+{
+    if (m_asynchronousPlugins.isEmpty())
+        return;
+
+    // all plugins of a level shut down at the same time, so waiting at most the
+    // per-plugin timeout bounds each of them
+    int timeout = m_pluginShutdownTimeout;
+    if (!deadline.isForever())
+        timeout = int(qMin<qint64>(timeout, deadline.remainingTime()));
+    QEventLoop eventLoop;
+    m_shutdownEventLoop = &eventLoop;
+    QTimer::singleShot(timeout, &eventLoop, &QEventLoop::quit);
+    eventLoop.exec();
+    m_shutdownEventLoop = nullptr;
+
+    for (const PluginSpecification *spec : std::as_const(m_asynchronousPlugins))
+        qWarning() << "Plugin" << spec->name() << "did not finish its asynchronous shutdown in time";
+    m_asynchronousPlugins.clear();
+}
+
+void PluginManager::setShutdownTimeout(int msecs)
+{
+    m_shutdownTimeout = msecs;
+}
+
+int PluginManager::shutdownTimeout() const
+{
+    return m_shutdownTimeout;
+}
+
+void PluginManager::setPluginShutdownTimeout(int msecs)
+{
+    m_pluginShutdownTimeout = msecs;
+}
+
+int PluginManager::pluginShutdownTimeout() const
+{
+    return m_pluginShutdownTimeout;
+}
+
+bool PluginManager::activatePlugin(PluginSpecification *spec)
+{
+    if (QThread::currentThread() != thread()) {
+        bool result = false;
+        callOnMainThread([this, spec, &result] { result = activatePlugin(spec); });
+        return result;
+    }
+    if (spec->state() == PluginState::Running)
+        return true;
+    if (spec->hasError() || spec->state() != PluginState::Resolved)
+        return false;
+
+    // bring up the spec together with whatever it depends on that is not running yet
+    QVector<PluginSpecification *> queue;
+    QHash<PluginSpecification *, qsizetype> marks;
+    QVector<LoadQueueFrame> path;
+    if (!loadQueue(spec, queue, marks, path))
+        return false;
+    queue.removeIf([](PluginSpecification *queued) { return queued->state() != PluginState::Resolved; });
+    startPlugins(queue);
+
+    {
+        QWriteLocker lock(&m_lock);
+        for (PluginSpecification *activated : std::as_const(queue)) {
+            const QStringList &interfaces = activated->interfaces();
+            for (const QString &interfaceName : interfaces) {
+                auto it = m_lazyInterfaces.find(interfaceName);
+                if (it == m_lazyInterfaces.end())
+                    continue;
+                it->removeOne(activated);
+                if (it->isEmpty())
+                    m_lazyInterfaces.erase(it);
+            }
+        }
+        m_hasLazyInterfaces.store(!m_lazyInterfaces.isEmpty(), std::memory_order_release);
+    }
+    emit pluginsChanged();
+    if (m_isInitializationDone && !m_delayedInitializeTimer.isActive())
+        scheduleDelayedInitialize(kDelayedInitializeInterval);
+    return spec->state() == PluginState::Running;
+}
+
+bool PluginManager::reloadPlugin(const QString &name)
+{
+    if (QThread::currentThread() != thread()) {
+        bool result = false;
+        callOnMainThread([this, &name, &result] { result = reloadPlugin(name); });
+        return result;
+    }
+    // of several installed versions, the one that runs is the one to reload
+    const QVector<PluginSpecification *> candidates = m_specsByName.value(name.toCaseFolded());
+    if (candidates.isEmpty())
+        return false;
+    PluginSpecification *spec = candidates.first();
+    for (PluginSpecification *candidate : candidates) {
+        if (candidate->state() == PluginState::Running)
+            spec = candidate;
+    }
+
+    // the plugin and everything that depends on it, directly or not
+    QVector<PluginSpecification *> affectedOrder{spec};
+    QSet<PluginSpecification *> affected{spec};
+    for (qsizetype i = 0; i < affectedOrder.size(); ++i) {
+        const QVector<PluginSpecification *> dependents = m_dependents.value(affectedOrder.at(i));
+        for (PluginSpecification *dependent : dependents) {
+            if (!affected.contains(dependent)) {
+                affected.insert(dependent);
+                affectedOrder.append(dependent);
+            }
+        }
+    }
+    QVector<PluginSpecification *> queue;
+    QHash<PluginSpecification *, qsizetype> marks;
+    QVector<LoadQueueFrame> path;
+    for (PluginSpecification *affectedSpec : std::as_const(affectedOrder))
+        loadQueue(affectedSpec, queue, marks, path);
+    queue.removeIf([&affected](PluginSpecification *queued) { return !affected.contains(queued); });
+
+    // take the subgraph down like a shutdown, the rest of the plugins keep running;
+    // whatever got started before is started again, lazy plugins stay lazy
+    QSet<PluginSpecification *> restart;
+    for (PluginSpecification *queued : std::as_const(queue)) {
+        if (queued->state() > PluginState::Resolved)
+            restart.insert(queued);
+    }
+    const QDeadlineTimer deadline(m_shutdownTimeout);
+    const QVector<QVector<PluginSpecification *>> levels = shutdownLevels(queue);
+    for (const QVector<PluginSpecification *> &level : levels) {
+        stopPlugins(level);
+        waitForAsynchronousShutdown(deadline);
+    }
+    Utils::reverseForeach(queue, [this](PluginSpecification *queued) {
+        loadPlugin(queued, PluginState::Deleted);
+    });
+    for (auto it = m_delayedInitializeQueue.begin(); it != m_delayedInitializeQueue.end();) {
+        it->second.removeIf([&affected](PluginSpecification *queued) { return affected.contains(queued); });
+        it = it->second.isEmpty() ? m_delayedInitializeQueue.erase(it) : std::next(it);
+    }
+    QSet<PluginSpecification *> lazy;
+    {
+        QWriteLocker lock(&m_lock);
+        for (auto it = m_lazyInterfaces.begin(); it != m_lazyInterfaces.end();) {
+            it->removeIf([&affected, &lazy](PluginSpecification *provider) {
+                if (!affected.contains(provider))
+                    return false;
+                lazy.insert(provider);
+                return true;
+            });
+            it = it->isEmpty() ? m_lazyInterfaces.erase(it) : std::next(it);
+        }
+    }
+    // dependents first, the dynamic linker only lets go of a library nothing links against
+    Utils::reverseForeach(queue, [](PluginSpecification *queued) { queued->unloadLibrary(); });
+    for (PluginSpecification *queued : std::as_const(queue)) {
+        for (PluginSpecification *dependency : queued->dependencySpecifications())
+            m_dependents[dependency].removeOne(queued);
+    }
+
+    const QString filePath = spec->m_filePath;
+    const std::optional<QStaticPlugin> staticPlugin = spec->m_staticPlugin;
+    const StaticPluginMetaData *staticMetaData = spec->m_staticMetaData;
+    const QStringList arguments = spec->arguments();
+    unindexSpec(spec);
+    bool isRead = false;
+    {
+        PluginProfiler::Scope profile(m_profiler, ProfilePhase::Read, spec->name());
+        if (staticPlugin)
+            isRead = spec->read(*staticPlugin);
+        else if (staticMetaData)
+            isRead = spec->read(*staticMetaData);
+        else
+            isRead = spec->read(filePath);
+        profile.setPluginName(spec->name());
+    }
+    spec->addArguments(arguments);
+    if (!isRead && !spec->hasError())
+        spec->reportError(Tr::tr("Cannot reload plugin %1: %2 is not a plugin anymore").arg(name, filePath));
+    indexSpec(spec);
+
+    {
+        PluginProfiler::Scope profile(m_profiler, ProfilePhase::ResolveDependencies, spec->name());
+        for (PluginSpecification *queued : std::as_const(queue)) {
+            queued->resolveDependencies(m_specsByName);
+            for (PluginSpecification *dependency : queued->dependencySpecifications())
+                m_dependents[dependency].append(queued);
+        }
+    }
+    // the order may have changed, and with it what the startup snapshot recorded
+    m_restoredLoadQueue.reset();
+
+    QVector<PluginSpecification *> restartQueue;
+    marks.clear();
+    for (PluginSpecification *queued : std::as_const(queue)) {
+        if (restart.contains(queued))
+            loadQueue(queued, restartQueue, marks, path);
+    }
+    restartQueue.removeIf([](PluginSpecification *queued) { return queued->state() != PluginState::Resolved; });
+    {
+        QWriteLocker lock(&m_lock);
+        for (PluginSpecification *provider : std::as_const(lazy)) {
+            const QStringList &interfaces = provider->interfaces();
+            for (const QString &interfaceName : interfaces)
+                m_lazyInterfaces[interfaceName].append(provider);
+        }
+        m_hasLazyInterfaces.store(!m_lazyInterfaces.isEmpty(), std::memory_order_release);
+    }
+    startPlugins(restartQueue);
+
+    emit pluginsChanged();
+    if (m_isInitializationDone && !m_delayedInitializeTimer.isActive())
+        scheduleDelayedInitialize(kDelayedInitializeInterval);
+    return !spec->hasError();
+}
+
+void PluginManager::activatePluginsProviding(const QString &interfaceName)
+{
+    QVector<PluginSpecification *> providers;
+    {
+        QReadLocker lock(&m_lock);
+        providers = m_lazyInterfaces.value(interfaceName);
+    }
+    for (PluginSpecification *spec : std::as_const(providers))
+        activatePlugin(spec);
+}
+
+void PluginManager::setParallelInitializationEnabled(bool enabled)
+{
+    m_parallelInitialization = enabled;
+}
+
+bool PluginManager::isParallelInitializationEnabled() const
+{
+    return m_parallelInitialization;
+}
+
+void PluginManager::setLibraryPrefetchEnabled(bool enabled)
+{
+    m_libraryPrefetch = enabled;
+}
+
+bool PluginManager::isLibraryPrefetchEnabled() const
+{
+    return m_libraryPrefetch;
+}
+
+void PluginManager::setPluginPathWatchingEnabled(bool enabled)
+{
+    if (enabled == bool(m_pathWatcher))
+        return;
+    if (!enabled) {
+        m_pathWatcher.reset();
+        return;
+    }
+    m_pathWatcher = std::make_unique<PluginPathWatcher>();
+    connect(m_pathWatcher.get(),
+            &PluginPathWatcher::librariesChanged,
             this,
-            &PluginManager::startDelayedInitialize);
-    m_delayedInitializeTimer.start();
+            &PluginManager::updatePluginFiles);
+    m_pathWatcher->watch(m_pluginPaths);
+}
+
+bool PluginManager::isPluginPathWatchingEnabled() const
+{
+    return bool(m_pathWatcher);
 }
 
 const QVector<PluginSpecification *> PluginManager::loadQueue()
 {
+    if (m_restoredLoadQueue)
+        return *m_restoredLoadQueue;
+    PluginProfiler::Scope profile(m_profiler, ProfilePhase::ResolveQueue, QString());
     QVector<PluginSpecification *> queue;
-    for (PluginSpecification *spec : std::as_const(m_pluginSpecifications)) {
-        QVector<PluginSpecification *> circularityCheckQueue;
-        loadQueue(spec, queue, circularityCheckQueue);
-    }
+    queue.reserve(m_pluginSpecs.size());
+    QHash<PluginSpecification *, qsizetype> marks;
+    marks.reserve(m_pluginSpecs.size());
+    QVector<LoadQueueFrame> path;
+    for (PluginSpecification *spec : std::as_const(m_pluginSpecs))
+        loadQueue(spec, queue, marks, path);
     return queue;
 }
 } // namespace ExtensionSystem
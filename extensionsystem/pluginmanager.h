@@ -3,52 +3,263 @@
 #include <QString>
 #include <QObject>
 #include <QReadWriteLock>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
 #include <QPointer>
 #include <QSet>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QEventLoop>
 #include <QTimer>
 #include <QQueue>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <utils/settings.h>
+#include "pluginprofiler.h"
 #include "pluginspecification.h"
+#include "staticpluginmetadata.h"
 
 namespace ExtensionSystem
 {
+class PluginPathWatcher;
+
+// Immutable view of the object pool. Writers publish a new version, readers keep
+// whichever version they loaded for as long as they hold on to it.
+struct ObjectPoolSnapshot
+{
+    QVector<QPointer<QObject>> objects;
+    QHash<QByteArray, QVector<QObject *>> index;
+};
+
+struct DelayedInitializeStatistics
+{
+    qsizetype queueDepth = 0;
+    int slices = 0;
+    // longest time a single slice kept the event loop busy, in ms
+    qint64 worstSlice = 0;
+    // longest time the event loop took to come back to the scheduler, in ms
+    qint64 worstLatency = 0;
+};
+
 class PluginManager : public QObject
 {
     Q_OBJECT
 public:
     static PluginManager &instance();
-    static QString platformName();
-    QString pluginIID() const;
+    static const QString &platformName();
+    const QString &pluginIID() const;
     void setPluginIID(const QString &newPluginIID);
 
+    void setPluginPaths(const QStringList &paths);
+    QStringList pluginPaths() const;
+    void setStaticPlugins(const QVector<QStaticPlugin> &plugins);
+    QVector<QStaticPlugin> staticPlugins() const;
+    void registerStaticPlugins();
+
+    // Metadata is checked at compile time, see StaticPluginMetaData. Registering the
+    // same metadata again does nothing.
+    template<const StaticPluginMetaData &...MetaData>
+    void registerStaticPluginMetaData()
+    {
+        static_assert((isValidStaticPluginMetaData(MetaData) && ...));
+        addStaticPluginMetaData({&MetaData...});
+    }
+    const QVector<PluginSpecification *> &plugins() const;
+    QVector<PluginSpecification *> dependents(PluginSpecification *spec) const;
+    void setMetaDataCacheFile(const QString &fileName);
+    QString metaDataCacheFile() const;
+    void setStartupSnapshotFile(const QString &fileName);
+    QString startupSnapshotFile() const;
+
     void addObject(QObject *obj);
     void removeObject(QObject *obj);
     QVector<QPointer<QObject>> allObjects();
+    std::shared_ptr<const ObjectPoolSnapshot> objectPoolSnapshot() const;
+    QObject *getObjectByInterface(const QString &interfaceName);
+    QVector<QObject *> getObjectsByInterface(const QString &interfaceName);
     QReadWriteLock *listLock();
 
+    template<typename T>
+    T *getObject()
+    {
+        const QVector<QObject *> objects = objectsForKey(interfaceKey<T>());
+        return objects.isEmpty() ? nullptr : qobject_cast<T *>(objects.first());
+    }
+
+    template<typename T>
+    QVector<T *> getObjects()
+    {
+        const QVector<QObject *> objects = objectsForKey(interfaceKey<T>());
+        QVector<T *> result;
+        result.reserve(objects.size());
+        for (QObject *obj : objects)
+            result.append(qobject_cast<T *>(obj));
+        return result;
+    }
+
     void loadPlugins();
+    void shutdown();
+    void setShutdownTimeout(int msecs);
+    int shutdownTimeout() const;
+    void setPluginShutdownTimeout(int msecs);
+    int pluginShutdownTimeout() const;
+    bool activatePlugin(PluginSpecification *spec);
+    // Stops the plugin and everything depending on it, reads it again and brings the
+    // ones that were running back up. Objects the plugins created must be gone once
+    // they are deleted, their code is unloaded.
+    bool reloadPlugin(const QString &name);
+    void setParallelInitializationEnabled(bool enabled);
+    bool isParallelInitializationEnabled() const;
+    void setLibraryPrefetchEnabled(bool enabled);
+    bool isLibraryPrefetchEnabled() const;
+    // Follows libraries being added, replaced or removed in the plugin paths after
+    // they were read, see PluginPathWatcher.
+    void setPluginPathWatchingEnabled(bool enabled);
+    bool isPluginPathWatchingEnabled() const;
+    void setDelayedInitializeBudget(int msecs);
+    int delayedInitializeBudget() const;
+    DelayedInitializeStatistics delayedInitializeStatistics() const;
     const QVector<PluginSpecification *> loadQueue();
     Utils::Settings *settings() const;
     void setSettings(Utils::Settings *settings);
+    PluginProfiler &profiler();
 
 private:
+    struct ObjectEntry
+    {
+        QMetaObject::Connection destroyedConnection;
+        QVector<QByteArray> keys;
+    };
+
+    // a spec on the dependency path of loadQueue()
+    struct LoadQueueFrame
+    {
+        PluginSpecification *spec;
+        qsizetype nextDependency;
+        PluginSpecification *pendingDependency;
+    };
+
+    // a call a pool worker needs the main thread for, see callOnMainThread()
+    struct WorkerCall
+    {
+        std::function<void()> function;
+        bool *done;
+    };
+
+    template<typename T>
+    static QByteArray interfaceKey()
+    {
+        if constexpr (std::is_base_of_v<QObject, T>)
+            return QByteArray(T::staticMetaObject.className());
+        else
+            return QByteArray(qobject_interface_iid<T *>());
+    }
+
     PluginManager();
+    QVector<QObject *> objectsForKey(const QByteArray &key);
+    void unindexObject(QObject *obj);
+    ~PluginManager() override;
+    void addStaticPluginMetaData(const QVector<const StaticPluginMetaData *> &metaData);
+    void readPluginPaths();
+    void updatePluginFiles(const QStringList &added, const QStringList &changed, const QStringList &removed);
+    void addStaticSpecs(const QVector<PluginSpecification *> &specs);
+    void resolveUpdatedSpecs(const QVector<PluginSpecification *> &updated, const QSet<QString> &changedNames);
+    bool isSpecInUse(PluginSpecification *spec) const;
+    void unlinkSpec(PluginSpecification *spec);
+    void resolveDependencies();
+    void indexSpecs();
+    void indexSpec(PluginSpecification *spec);
+    void unindexSpec(PluginSpecification *spec);
+    bool restoreStartupSnapshot();
+    void indexDependents();
     bool loadQueue(PluginSpecification *spec,
                    QVector<PluginSpecification *> &queue,
-                   QVector<PluginSpecification *> &circularityCheckQueue);
+                   QHash<PluginSpecification *, qsizetype> &marks,
+                   QVector<LoadQueueFrame> &path);
+    bool prepareTransition(PluginSpecification *spec, PluginState destState);
     void loadPlugin(PluginSpecification *spec, PluginState destState);
+    void clearLazyInterfaces();
+    QVector<PluginSpecification *> startupQueue(const QVector<PluginSpecification *> &queue);
+    void startPlugins(const QVector<PluginSpecification *> &queue);
+    void activatePluginsProviding(const QString &interfaceName);
+    void initializePluginsInParallel(const QVector<PluginSpecification *> &queue);
+    void runWorkerCalls(const QQueue<WorkerCall> &calls);
+    void callOnMainThread(const std::function<void()> &function);
+    void preloadLibraries(const QVector<PluginSpecification *> &queue);
+    void waitForLibrary(PluginSpecification *spec);
+    void finishLibraryPreloading(const QVector<PluginSpecification *> &queue);
+    void enqueueDelayedInitialize(PluginSpecification *spec);
+    void scheduleDelayedInitialize(int interval);
     void startDelayedInitialize();
+    QVector<QVector<PluginSpecification *>> shutdownLevels(const QVector<PluginSpecification *> &queue) const;
+    void stopPlugins(const QVector<PluginSpecification *> &level);
+    void watchAsynchronousShutdown(PluginSpecification *spec);
+    void waitForAsynchronousShutdown(const QDeadlineTimer &deadline);
+    void reportProfile();
     QString m_pluginIID;
-    Utils::Settings *m_settings;
+    Utils::Settings *m_settings = nullptr;
+    QStringList m_pluginPaths;
+    std::unique_ptr<PluginPathWatcher> m_pathWatcher;
+    QVector<QStaticPlugin> m_staticPlugins;
+    QVector<const StaticPluginMetaData *> m_staticMetaData;
+    QString m_metaDataCacheFile;
+    QString m_startupSnapshotFile;
+    // load order taken over from the startup snapshot, replaces the traversal in loadQueue()
+    std::optional<QVector<PluginSpecification *>> m_restoredLoadQueue;
     mutable QReadWriteLock m_lock;
-    QVector<QPointer<QObject>> m_allObjects;
+    // published view of m_objectPoolState, see objectPoolSnapshot()
+    mutable std::atomic<std::shared_ptr<const ObjectPoolSnapshot>> m_objectPool;
+    mutable std::atomic<bool> m_objectPoolStale = false;
+    mutable QMutex m_objectPoolMutex;
+    ObjectPoolSnapshot m_objectPoolState;
+    // changed with m_objectPoolMutex held as well, so destroyed objects can leave it
+    QHash<QObject *, ObjectEntry> m_objects;
+    // interfaces that matched a pooled object, tested against every object added
+    QSet<QByteArray> m_interfaceKeys;
     QSet<PluginSpecification *> m_asynchronousPlugins;
     QVector<PluginSpecification *> m_pluginSpecs;
+    QHash<QString, QVector<PluginSpecification *>> m_specsByName;
+    QHash<QString, PluginSpecification *> m_specsByFile;
+    // specs by the names they declare dependencies on, whether resolved or not
+    QHash<QString, QVector<PluginSpecification *>> m_dependentsByName;
+    // reverse of PluginSpecification::dependencySpecifications()
+    QHash<PluginSpecification *, QVector<PluginSpecification *>> m_dependents;
+    QHash<QString, QVector<PluginSpecification *>> m_lazyInterfaces;
+    std::atomic<bool> m_hasLazyInterfaces = false;
     QEventLoop *m_shutdownEventLoop = nullptr;
-    QQueue<PluginSpecification *> m_delayedInitializeQueue;
+    int m_shutdownTimeout;
+    int m_pluginShutdownTimeout;
+    // delayed initialization runs by descending priority, in queue order within one priority
+    std::map<int, QQueue<PluginSpecification *>, std::greater<int>> m_delayedInitializeQueue;
     QTimer m_delayedInitializeTimer;
+    QElapsedTimer m_delayedInitializeClock;
+    qint64 m_delayedInitializeDue = 0;
+    int m_delayedInitializeBudget;
+    DelayedInitializeStatistics m_delayedInitializeStatistics;
     bool m_isInitializationDone = false;
+    // between loadPlugins() and shutdown(), specs may belong to running plugins
+    bool m_pluginsLoaded = false;
+    bool m_parallelInitialization = false;
+    QThreadPool m_libraryPool;
+    bool m_libraryPrefetch = true;
+    QThreadPool m_prefetchPool;
+    QMutex m_libraryMutex;
+    QWaitCondition m_libraryPreloaded;
+    QSet<PluginSpecification *> m_preloadingLibraries;
+    // the main thread is waiting in initializePluginsInParallel() (nested through
+    // activatePlugin()), it runs m_workerCalls there
+    QMutex m_workerMutex;
+    QWaitCondition m_workerEvent;
+    QWaitCondition m_workerCallDone;
+    QQueue<WorkerCall> m_workerCalls;
+    int m_waitingForWorkers = 0;
+    PluginProfiler m_profiler;
+    QString m_profileTraceFile;
 signals:
     void objectAdded(QObject *obj);
     void aboutToRemoveObject(QObject *obj);
@@ -0,0 +1,256 @@
+﻿#include "pluginmetadatacache.h"
+#include <QCborMap>
+#include <QCborValue>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QSaveFile>
+#include "pluginspecification.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+namespace ExtensionSystem {
+
+namespace Constants
+{
+constexpr quint32 kCacheMagic = 0x504d4443; // "PMDC"
+constexpr quint32 kCacheFormatVersion = 8;
+constexpr QDataStream::Version kCacheStreamVersion = QDataStream::Qt_5_15;
+}
+
+PluginFileIdentity PluginFileIdentity::fromFile(const QString &filePath)
+{
+    PluginFileIdentity identity;
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(filePath).constData(), &st) != 0)
+        return identity;
+    identity.size = st.st_size;
+#ifdef Q_OS_MACOS
+    identity.modificationTime = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    identity.modificationTime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    identity.inode = st.st_ino;
+#else
+    const QFileInfo fileInfo(filePath);
+    if (!fileInfo.exists())
+        return identity;
+    identity.size = fileInfo.size();
+    identity.modificationTime = fileInfo.lastModified().toMSecsSinceEpoch() * 1000000;
+#endif
+    return identity;
+}
+
+QByteArray PluginMetaDataCache::packSpec(const PluginSpecification &spec)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(Constants::kCacheStreamVersion);
+    out << spec.m_name << spec.m_version << spec.m_compatVersion
+        << spec.m_versionNumber.packed() << spec.m_compatVersionNumber.packed() << spec.m_vendor
+        << spec.m_category << spec.m_revision << spec.m_platformSpecification << spec.m_required
+        << spec.m_experimental << spec.m_enabledByDefault << spec.m_threadSafeInitialize
+        << spec.m_threadSafeShutdown << spec.m_lazy << qint32(spec.m_delayedInitializePriority)
+        << spec.m_interfaces << qint32(spec.m_loadHints.toInt());
+    out << quint32(spec.m_dependencies.size());
+    for (const PluginDependency &dep : spec.m_dependencies)
+        out << dep.name << dep.version.packed() << quint8(dep.type);
+    out << quint32(spec.m_argumentDescriptions.size());
+    for (const PluginArgumentDescription &arg : spec.m_argumentDescriptions)
+        out << arg.name << arg.parameter << arg.description;
+    // only what reading found, resolution errors are not the file's
+    const QString metaDataError = spec.metaDataErrorString();
+    out << !metaDataError.isEmpty() << metaDataError;
+    out << QCborMap::fromJsonObject(spec.metaData()).toCborValue().toCbor();
+    return payload;
+}
+
+bool PluginMetaDataCache::unpackSpec(const QByteArray &payload, PluginSpecification *spec)
+{
+    QDataStream in(payload);
+    in.setVersion(Constants::kCacheStreamVersion);
+    QString platformSpec;
+    qint32 delayedInitializePriority = 0;
+    qint32 loadHints = 0;
+    quint64 versionNumber = 0;
+    quint64 compatVersionNumber = 0;
+    in >> spec->m_name >> spec->m_version >> spec->m_compatVersion >> versionNumber
+        >> compatVersionNumber >> spec->m_vendor >> spec->m_category >> spec->m_revision
+        >> platformSpec >> spec->m_required >> spec->m_experimental >> spec->m_enabledByDefault
+        >> spec->m_threadSafeInitialize >> spec->m_threadSafeShutdown >> spec->m_lazy
+        >> delayedInitializePriority >> spec->m_interfaces >> loadHints;
+    spec->m_delayedInitializePriority = delayedInitializePriority;
+    spec->m_loadHints = QLibrary::LoadHints::fromInt(loadHints);
+    spec->m_versionNumber = PluginVersion::fromPacked(versionNumber);
+    spec->m_compatVersionNumber = PluginVersion::fromPacked(compatVersionNumber);
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        PluginDependency dep;
+        quint8 type = 0;
+        quint64 version = 0;
+        in >> dep.name >> version >> type;
+        dep.version = PluginVersion::fromPacked(version);
+        dep.type = PluginDependency::Type(type);
+        spec->m_dependencies.append(dep);
+    }
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        PluginArgumentDescription arg;
+        in >> arg.name >> arg.parameter >> arg.description;
+        spec->m_argumentDescriptions.append(arg);
+    }
+    bool hasError = false;
+    QString errorString;
+    in >> hasError >> errorString;
+    if (hasError)
+        spec->m_metaDataErrorString = errorString;
+    in >> spec->m_packedMetaData;
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    spec->m_name = PluginSpecification::intern(spec->m_name);
+    spec->m_vendor = PluginSpecification::intern(spec->m_vendor);
+    spec->m_category = PluginSpecification::intern(spec->m_category);
+    for (PluginDependency &dep : spec->m_dependencies)
+        dep.name = PluginSpecification::intern(dep.name);
+    // the pattern is only compiled and matched if nothing else knows the answer
+    spec->m_platformSpecification = platformSpec;
+    spec->m_enabledBySettings = spec->m_enabledByDefault;
+    return true;
+}
+
+PluginMetaDataCache::PluginMetaDataCache(const QString &fileName, const QString &pluginIID)
+    : m_fileName(fileName)
+    , m_pluginIID(pluginIID)
+    , m_file(fileName)
+{
+    load();
+}
+
+PluginMetaDataCache::~PluginMetaDataCache()
+{
+    if (m_mapped)
+        m_file.unmap(m_mapped);
+}
+
+QString PluginMetaDataCache::fileName() const
+{
+    return m_fileName;
+}
+
+void PluginMetaDataCache::load()
+{
+    if (!m_file.open(QIODevice::ReadOnly))
+        return;
+    m_mapped = m_file.map(0, m_file.size());
+    if (!m_mapped)
+        return;
+
+    // payloads stay in the mapping and are only decoded on a hit
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(m_mapped),
+                                                    m_file.size());
+    QDataStream in(data);
+    in.setVersion(Constants::kCacheStreamVersion);
+    quint32 magic = 0;
+    quint32 formatVersion = 0;
+    QString pluginIID;
+    quint32 count = 0;
+    in >> magic >> formatVersion >> pluginIID >> count;
+    if (in.status() != QDataStream::Ok || magic != Constants::kCacheMagic
+        || formatVersion != Constants::kCacheFormatVersion || pluginIID != m_pluginIID) {
+        return;
+    }
+    m_entries.reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        QString filePath;
+        Entry entry;
+        quint32 payloadSize = 0;
+        in >> filePath >> entry.identity.size >> entry.identity.modificationTime
+            >> entry.identity.inode >> entry.isPlugin >> payloadSize;
+        const qint64 offset = in.device()->pos();
+        if (in.status() != QDataStream::Ok || offset + payloadSize > data.size()) {
+            m_entries.clear();
+            return;
+        }
+        entry.payload = QByteArray::fromRawData(data.constData() + offset, payloadSize);
+        in.skipRawData(payloadSize);
+        m_entries.insert(filePath, entry);
+    }
+}
+
+bool PluginMetaDataCache::lookup(const QString &filePath,
+                                 const PluginFileIdentity &identity,
+                                 PluginSpecification *spec,
+                                 bool *isPlugin)
+{
+    const auto it = m_entries.constFind(filePath);
+    if (!identity.isValid() || it == m_entries.cend() || !(it->identity == identity))
+        return false;
+    if (it->isPlugin) {
+        if (!unpackSpec(it->payload, spec))
+            return false;
+        const QFileInfo fileInfo(filePath);
+        spec->m_location = PluginSpecification::intern(fileInfo.absolutePath());
+        spec->m_filePath = fileInfo.absoluteFilePath();
+        spec->m_state = PluginState::Read;
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_used.insert(filePath);
+    }
+    *isPlugin = it->isPlugin;
+    return true;
+}
+
+void PluginMetaDataCache::insert(const QString &filePath,
+                                 const PluginFileIdentity &identity,
+                                 const PluginSpecification *spec)
+{
+    if (!identity.isValid())
+        return;
+    Entry entry;
+    entry.identity = identity;
+    entry.isPlugin = spec != nullptr;
+    if (spec)
+        entry.payload = packSpec(*spec);
+    QMutexLocker locker(&m_mutex);
+    m_updates.insert(filePath, entry);
+}
+
+bool PluginMetaDataCache::save()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_updates.isEmpty() && m_used.size() == m_entries.size())
+        return true;
+
+    QHash<QString, Entry> entries = m_updates;
+    for (const QString &filePath : std::as_const(m_used))
+        entries.insert(filePath, m_entries.value(filePath));
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(Constants::kCacheStreamVersion);
+    out << Constants::kCacheMagic << Constants::kCacheFormatVersion << m_pluginIID
+        << quint32(entries.size());
+    for (auto it = entries.cbegin(), end = entries.cend(); it != end; ++it) {
+        out << it.key() << it->identity.size << it->identity.modificationTime
+            << it->identity.inode << it->isPlugin << quint32(it->payload.size());
+        out.writeRawData(it->payload.constData(), int(it->payload.size()));
+    }
+    if (out.status() != QDataStream::Ok || !file.commit())
+        return false;
+
+    m_updates.clear();
+    m_used.clear();
+    return true;
+}
+
+} // namespace ExtensionSystem
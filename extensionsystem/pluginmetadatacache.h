@@ -0,0 +1,66 @@
+﻿#pragma once
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+namespace ExtensionSystem {
+
+class PluginSpecification;
+
+struct PluginFileIdentity
+{
+    static PluginFileIdentity fromFile(const QString &filePath);
+
+    bool isValid() const { return size >= 0; }
+    bool operator==(const PluginFileIdentity &other) const = default;
+
+    qint64 size = -1;
+    qint64 modificationTime = 0;
+    quint64 inode = 0;
+};
+
+// Keeps the validated fields of every scanned library in a binary file, so that
+// unchanged libraries are neither opened through QPluginLoader nor re-validated.
+// lookup() and insert() may be called from the scanning workers concurrently.
+class PluginMetaDataCache
+{
+public:
+    PluginMetaDataCache(const QString &fileName, const QString &pluginIID);
+    ~PluginMetaDataCache();
+
+    QString fileName() const;
+
+    bool lookup(const QString &filePath,
+                const PluginFileIdentity &identity,
+                PluginSpecification *spec,
+                bool *isPlugin);
+    void insert(const QString &filePath,
+                const PluginFileIdentity &identity,
+                const PluginSpecification *spec);
+    bool save();
+
+private:
+    struct Entry
+    {
+        PluginFileIdentity identity;
+        bool isPlugin = false;
+        QByteArray payload;
+    };
+
+    static QByteArray packSpec(const PluginSpecification &spec);
+    static bool unpackSpec(const QByteArray &payload, PluginSpecification *spec);
+    void load();
+
+    QString m_fileName;
+    QString m_pluginIID;
+    QFile m_file;
+    uchar *m_mapped = nullptr;
+    QHash<QString, Entry> m_entries;
+    QMutex m_mutex;
+    QSet<QString> m_used;
+    QHash<QString, Entry> m_updates;
+};
+
+} // namespace ExtensionSystem
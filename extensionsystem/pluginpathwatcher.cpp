@@ -0,0 +1,170 @@
+﻿#include "pluginpathwatcher.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QLibrary>
+#include <algorithm>
+
+namespace ExtensionSystem {
+
+namespace Constants {
+constexpr int kDefaultCoalescingInterval = 300;
+} // namespace Constants
+
+PluginPathWatcher::PluginPathWatcher(QObject *parent)
+    : QObject(parent)
+{
+    m_coalescingTimer.setSingleShot(true);
+    m_coalescingTimer.setInterval(Constants::kDefaultCoalescingInterval);
+    connect(&m_coalescingTimer, &QTimer::timeout, this, &PluginPathWatcher::flush);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &PluginPathWatcher::directoryChanged);
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &PluginPathWatcher::fileChanged);
+}
+
+void PluginPathWatcher::watch(const QStringList &paths)
+{
+    clear();
+    for (const QString &path : paths)
+        addDirectory(QDir(path).absolutePath(), nullptr);
+}
+
+void PluginPathWatcher::clear()
+{
+    m_coalescingTimer.stop();
+    const QStringList watched = m_watcher.directories() + m_watcher.files();
+    if (!watched.isEmpty())
+        m_watcher.removePaths(watched);
+    m_directories.clear();
+    m_files.clear();
+    m_dirtyDirectories.clear();
+    m_dirtyFiles.clear();
+}
+
+void PluginPathWatcher::setCoalescingInterval(int msecs)
+{
+    m_coalescingTimer.setInterval(msecs);
+}
+
+int PluginPathWatcher::coalescingInterval() const
+{
+    return m_coalescingTimer.interval();
+}
+
+void PluginPathWatcher::directoryChanged(const QString &path)
+{
+    m_dirtyDirectories.insert(path);
+    m_coalescingTimer.start();
+}
+
+void PluginPathWatcher::fileChanged(const QString &path)
+{
+    m_dirtyFiles.insert(path);
+    m_coalescingTimer.start();
+}
+
+void PluginPathWatcher::addDirectory(const QString &path, QStringList *added)
+{
+    if (m_directories.contains(path))
+        return;
+    const QDir dir(path);
+    QSet<QString> &files = m_directories[path];
+    m_watcher.addPath(path);
+    const QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::NoSymLinks, QDir::Name);
+    for (const QFileInfo &entry : entries) {
+        const QString filePath = entry.absoluteFilePath();
+        if (!QLibrary::isLibrary(filePath))
+            continue;
+        files.insert(filePath);
+        m_files.insert(filePath, PluginFileIdentity::fromFile(filePath));
+        m_watcher.addPath(filePath);
+        if (added)
+            added->append(filePath);
+    }
+    const QFileInfoList subdirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    for (const QFileInfo &subdir : subdirs)
+        addDirectory(subdir.absoluteFilePath(), added);
+}
+
+void PluginPathWatcher::removeDirectory(const QString &path, QStringList *removed)
+{
+    const QString prefix = path + QLatin1Char('/');
+    for (auto it = m_directories.begin(); it != m_directories.end();) {
+        if (it.key() != path && !it.key().startsWith(prefix)) {
+            ++it;
+            continue;
+        }
+        for (const QString &filePath : std::as_const(*it)) {
+            m_files.remove(filePath);
+            removed->append(filePath);
+        }
+        it = m_directories.erase(it);
+    }
+}
+
+void PluginPathWatcher::flush()
+{
+    QStringList added;
+    QStringList changed;
+    QStringList removed;
+
+    // Directory events tell that names came or went. Only the names are compared,
+    // files that changed in place come with events of their own.
+    QStringList directories(m_dirtyDirectories.cbegin(), m_dirtyDirectories.cend());
+    m_dirtyDirectories.clear();
+    std::sort(directories.begin(), directories.end());
+    for (const QString &path : std::as_const(directories)) {
+        if (!m_directories.contains(path))
+            continue;
+        const QDir dir(path);
+        if (!dir.exists()) {
+            removeDirectory(path, &removed);
+            continue;
+        }
+        QSet<QString> files;
+        QSet<QString> &known = m_directories[path];
+        const QStringList names = dir.entryList(QDir::Files | QDir::NoSymLinks, QDir::Name);
+        for (const QString &name : names) {
+            const QString filePath = dir.absoluteFilePath(name);
+            if (!QLibrary::isLibrary(filePath))
+                continue;
+            files.insert(filePath);
+            if (known.contains(filePath))
+                continue;
+            m_files.insert(filePath, PluginFileIdentity::fromFile(filePath));
+            m_watcher.addPath(filePath);
+            added.append(filePath);
+        }
+        for (const QString &filePath : std::as_const(known)) {
+            if (files.contains(filePath))
+                continue;
+            m_files.remove(filePath);
+            m_dirtyFiles.remove(filePath);
+            removed.append(filePath);
+        }
+        known = files;
+        const QStringList subdirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+        for (const QString &subdir : subdirs)
+            addDirectory(dir.absoluteFilePath(subdir), &added);
+    }
+
+    QStringList files(m_dirtyFiles.cbegin(), m_dirtyFiles.cend());
+    m_dirtyFiles.clear();
+    std::sort(files.begin(), files.end());
+    for (const QString &filePath : std::as_const(files)) {
+        const auto it = m_files.find(filePath);
+        if (it == m_files.end())
+            continue;
+        const PluginFileIdentity identity = PluginFileIdentity::fromFile(filePath);
+        // gone files are reported with their directory
+        if (!identity.isValid() || identity == *it)
+            continue;
+        *it = identity;
+        // a file replaced by a rename is a new inode, the old watch went with the old one
+        m_watcher.addPath(filePath);
+        changed.append(filePath);
+    }
+
+    if (!added.isEmpty() || !changed.isEmpty() || !removed.isEmpty())
+        emit librariesChanged(added, changed, removed);
+}
+
+} // namespace ExtensionSystem
@@ -0,0 +1,45 @@
+﻿#pragma once
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include "pluginmetadatacache.h"
+
+namespace ExtensionSystem {
+
+// Watches the plugin paths (inotify on Linux) and reports the libraries that were
+// added, changed or removed. Events are coalesced, a burst of them, e.g. an install
+// copying many files, ends in one librariesChanged() once the paths are quiet.
+class PluginPathWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PluginPathWatcher(QObject *parent = nullptr);
+
+    void watch(const QStringList &paths);
+    void clear();
+    void setCoalescingInterval(int msecs);
+    int coalescingInterval() const;
+
+signals:
+    void librariesChanged(const QStringList &added, const QStringList &changed, const QStringList &removed);
+
+private:
+    void directoryChanged(const QString &path);
+    void fileChanged(const QString &path);
+    void addDirectory(const QString &path, QStringList *added);
+    void removeDirectory(const QString &path, QStringList *removed);
+    void flush();
+
+    QFileSystemWatcher m_watcher;
+    QTimer m_coalescingTimer;
+    // library files per watched directory, with what they looked like when last seen
+    QHash<QString, QSet<QString>> m_directories;
+    QHash<QString, PluginFileIdentity> m_files;
+    QSet<QString> m_dirtyDirectories;
+    QSet<QString> m_dirtyFiles;
+};
+
+} // namespace ExtensionSystem
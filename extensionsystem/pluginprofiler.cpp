@@ -0,0 +1,239 @@
+﻿#include "pluginprofiler.h"
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace ExtensionSystem {
+
+constexpr int kPhaseCount = int(ProfilePhase::Delete) + 1;
+
+PluginProfiler::Scope::Scope(PluginProfiler &profiler, ProfilePhase phase, const QString &pluginName)
+    : m_phase(phase)
+{
+    if (!profiler.isEnabled())
+        return;
+    m_profiler = &profiler;
+    m_pluginName = pluginName;
+    m_majorFaults = threadMajorFaults();
+    m_start = profiler.now();
+}
+
+PluginProfiler::Scope::~Scope()
+{
+    if (!m_profiler)
+        return;
+    const qint64 duration = m_profiler->now() - m_start;
+    const qint64 majorFaults = m_majorFaults < 0 ? -1 : threadMajorFaults() - m_majorFaults;
+    m_profiler->record(m_phase, m_pluginName, m_start, duration, majorFaults);
+}
+
+void PluginProfiler::Scope::setPluginName(const QString &pluginName)
+{
+    if (m_profiler)
+        m_pluginName = pluginName;
+}
+
+PluginProfiler::PluginProfiler()
+{
+    m_clock.start();
+}
+
+void PluginProfiler::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void PluginProfiler::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_events.clear();
+}
+
+void PluginProfiler::record(ProfilePhase phase,
+                            const QString &pluginName,
+                            qint64 start,
+                            qint64 duration,
+                            qint64 majorFaults)
+{
+    const quint64 threadId = quint64(quintptr(QThread::currentThreadId()));
+    QMutexLocker locker(&m_mutex);
+    m_events.append({pluginName, phase, start, duration, threadId, majorFaults});
+}
+
+qint64 PluginProfiler::now() const
+{
+    return m_clock.nsecsElapsed();
+}
+
+qint64 PluginProfiler::threadMajorFaults()
+{
+#if defined(Q_OS_LINUX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        return usage.ru_majflt;
+#endif
+    return -1;
+}
+
+qint64 PluginProfiler::processMajorFaults()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_majflt;
+#endif
+    return -1;
+}
+
+qint64 PluginProfiler::processUptime()
+{
+#if defined(Q_OS_LINUX)
+    // field 22 of /proc/self/stat is the start time in clock ticks after boot, the
+    // command name before it may contain anything up to the last ')'
+    QFile stat(QLatin1String("/proc/self/stat"));
+    if (!stat.open(QIODevice::ReadOnly))
+        return -1;
+    const QByteArray content = stat.readAll();
+    const QList<QByteArray> fields = content.mid(content.lastIndexOf(')') + 2).split(' ');
+    bool ok = false;
+    const qint64 startTicks = fields.value(19).toLongLong(&ok);
+    const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    struct timespec now;
+    if (!ok || ticksPerSecond <= 0 || clock_gettime(CLOCK_BOOTTIME, &now) != 0)
+        return -1;
+    const qint64 nowNs = qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+    // the start time only has clock tick resolution
+    return qMax<qint64>(0, nowNs - startTicks * (1000000000 / ticksPerSecond));
+#else
+    return -1;
+#endif
+}
+
+QVector<PluginProfiler::Event> PluginProfiler::events() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_events;
+}
+
+QString PluginProfiler::phaseName(ProfilePhase phase)
+{
+    switch (phase) {
+    case ProfilePhase::Read:
+        return QLatin1String("read");
+    case ProfilePhase::ParseMetaData:
+        return QLatin1String("parseMetaData");
+    case ProfilePhase::ResolveQueue:
+        return QLatin1String("resolveQueue");
+    case ProfilePhase::ResolveDependencies:
+        return QLatin1String("resolveDependencies");
+    case ProfilePhase::Prefetch:
+        return QLatin1String("prefetch");
+    case ProfilePhase::LoadLibrary:
+        return QLatin1String("loadLibrary");
+    case ProfilePhase::Initialize:
+        return QLatin1String("initialize");
+    case ProfilePhase::ExtensionsInitialized:
+        return QLatin1String("extensionsInitialized");
+    case ProfilePhase::DelayedInitialize:
+        return QLatin1String("delayedInitialize");
+    case ProfilePhase::Stop:
+        return QLatin1String("stop");
+    case ProfilePhase::Delete:
+        return QLatin1String("delete");
+    }
+    return QString();
+}
+
+QByteArray PluginProfiler::chromeTrace() const
+{
+    // Chrome trace-event format, complete events with microsecond timestamps
+    QJsonArray traceEvents;
+    const QVector<Event> recorded = events();
+    for (const Event &event : recorded) {
+        QJsonObject traceEvent;
+        traceEvent.insert(QLatin1String("name"),
+                          event.pluginName.isEmpty() ? phaseName(event.phase) : event.pluginName);
+        traceEvent.insert(QLatin1String("cat"), phaseName(event.phase));
+        traceEvent.insert(QLatin1String("ph"), QLatin1String("X"));
+        traceEvent.insert(QLatin1String("ts"), double(event.start) / 1000.0);
+        traceEvent.insert(QLatin1String("dur"), double(event.duration) / 1000.0);
+        traceEvent.insert(QLatin1String("pid"), 1);
+        traceEvent.insert(QLatin1String("tid"), QString::number(event.threadId));
+        if (event.majorFaults >= 0) {
+            traceEvent.insert(QLatin1String("args"),
+                              QJsonObject{{QLatin1String("majorFaults"), event.majorFaults}});
+        }
+        traceEvents.append(traceEvent);
+    }
+    QJsonObject root;
+    root.insert(QLatin1String("traceEvents"), traceEvents);
+    root.insert(QLatin1String("displayTimeUnit"), QLatin1String("ms"));
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool PluginProfiler::writeChromeTrace(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(chromeTrace()) >= 0;
+}
+
+QString PluginProfiler::summary() const
+{
+    struct Row
+    {
+        QString pluginName;
+        qint64 phases[kPhaseCount] = {};
+        qint64 total = 0;
+        qint64 majorFaults = 0;
+    };
+    QVector<Row> rows;
+    QHash<QString, qsizetype> rowIndex;
+    const QVector<Event> recorded = events();
+    for (const Event &event : recorded) {
+        auto it = rowIndex.constFind(event.pluginName);
+        if (it == rowIndex.cend()) {
+            it = rowIndex.insert(event.pluginName, rows.size());
+            rows.append({event.pluginName});
+        }
+        Row &row = rows[*it];
+        row.phases[int(event.phase)] += event.duration;
+        row.total += event.duration;
+        row.majorFaults += qMax<qint64>(0, event.majorFaults);
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &left, const Row &right) {
+        return left.total > right.total;
+    });
+
+    const auto ms = [](qint64 nsecs) { return QString::number(double(nsecs) / 1000000.0, 'f', 3); };
+    QString result = QString::fromLatin1("%1").arg(QLatin1String("Plugin"), -32);
+    for (int phase = 0; phase < kPhaseCount; ++phase)
+        result += QString::fromLatin1(" %1").arg(phaseName(ProfilePhase(phase)), 22);
+    result += QString::fromLatin1(" %1").arg(QLatin1String("total [ms]"), 12);
+    result += QString::fromLatin1(" %1\n").arg(QLatin1String("major faults"), 12);
+    for (const Row &row : std::as_const(rows)) {
+        result += QString::fromLatin1("%1").arg(row.pluginName.isEmpty() ? QLatin1String("<manager>")
+                                                                         : row.pluginName,
+                                                -32);
+        for (int phase = 0; phase < kPhaseCount; ++phase)
+            result += QString::fromLatin1(" %1").arg(ms(row.phases[phase]), 22);
+        result += QString::fromLatin1(" %1").arg(ms(row.total), 12);
+        result += QString::fromLatin1(" %1\n").arg(row.majorFaults, 12);
+    }
+    return result;
+}
+
+} // namespace ExtensionSystem
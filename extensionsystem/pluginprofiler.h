@@ -0,0 +1,90 @@
+﻿#pragma once
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include "extensionsystemglobal.h"
+
+namespace ExtensionSystem {
+
+enum class ProfilePhase
+{
+    Read,
+    ParseMetaData,
+    ResolveQueue,
+    ResolveDependencies,
+    Prefetch,
+    LoadLibrary,
+    Initialize,
+    ExtensionsInitialized,
+    DelayedInitialize,
+    Stop,
+    Delete
+};
+
+class EXTENSIONSYSTEM_EXPORT PluginProfiler
+{
+public:
+    struct Event
+    {
+        QString pluginName;
+        ProfilePhase phase;
+        qint64 start;
+        qint64 duration;
+        quint64 threadId;
+        // major page faults the thread took during the event, -1 if unknown
+        qint64 majorFaults;
+    };
+
+    // Measures the lifetime of the scope. Does nothing beyond one relaxed load when
+    // the profiler is disabled.
+    class Scope
+    {
+    public:
+        Scope(PluginProfiler &profiler, ProfilePhase phase, const QString &pluginName);
+        ~Scope();
+        void setPluginName(const QString &pluginName);
+
+    private:
+        PluginProfiler *m_profiler = nullptr;
+        ProfilePhase m_phase;
+        QString m_pluginName;
+        qint64 m_start = 0;
+        qint64 m_majorFaults = 0;
+    };
+
+    PluginProfiler();
+
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled);
+    void clear();
+
+    void record(ProfilePhase phase,
+                const QString &pluginName,
+                qint64 start,
+                qint64 duration,
+                qint64 majorFaults = -1);
+    qint64 now() const;
+
+    // Page faults that needed I/O, -1 where the platform cannot tell
+    static qint64 threadMajorFaults();
+    static qint64 processMajorFaults();
+    // Time since the process was started in ns, -1 where the platform cannot tell
+    static qint64 processUptime();
+
+    QVector<Event> events() const;
+    QByteArray chromeTrace() const;
+    bool writeChromeTrace(const QString &fileName) const;
+    QString summary() const;
+
+    static QString phaseName(ProfilePhase phase);
+
+private:
+    std::atomic<bool> m_enabled = false;
+    QElapsedTimer m_clock;
+    mutable QMutex m_mutex;
+    QVector<Event> m_events;
+};
+
+} // namespace ExtensionSystem
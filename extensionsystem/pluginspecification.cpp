@@ -1,15 +1,23 @@
 ﻿#include "pluginspecification.h"
+#include <QCborMap>
+#include <QCborValue>
 #include <QFileInfo>
 #include <QHashFunctions>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QDir>
 #include <QLoggingCategory>
+#include <QMutex>
+#include <QSet>
 #include <utils/hostinfo.h>
 #include <utils/stringutils.h>
+#include "elfpluginprobe.h"
 #include "pluginmanager.h"
+#include "staticpluginmetadata.h"
 #include "extensionsystemtr.h"
 #include "iplugin.h"
+#include <algorithm>
+#include <iterator>
 
 
 Q_LOGGING_CATEGORY(pluginLog, "qtc.extensionsystem", QtWarningMsg)
@@ -18,33 +26,42 @@ namespace ExtensionSystem {
 
 namespace Constants
 {
-const char kPluginMetadata[] = "MetaData";
-const char kPluginName[] = "Name";
-const char kPluginVersion[] = "Version";
-const char kPluginCompatversion[] = "CompatVersion";
-const char kPluginRequired[] = "Required";
-const char kPluginExperimental[] = "Experimental";
-const char kPluginDisabledByDefault[] = "DisabledByDefault";
-const char kVendor[] = "Vendor";
-const char kCopyright[] = "Copyright";
-const char kLicense[] = "License";
-const char kDescription[] = "Description";
-const char kLongDescription[] = "LongDescription";
-const char kUrl[] = "Url";
-const char kCategory[] = "Category";
-const char kPlatform[] = "Platform";
-const char kDependencies[] = "Dependencies";
-const char kDependencyName[] = "Name";
-const char kDependencyVersion[] = "Version";
-const char kDependencyType[] = "Type";
-const char kDependencyTypeSoft[] = "optional";
-const char kDependencyTypeHard[] = "required";
-const char kDependencyTypeTest[] = "test";
-const char kArguments[] = "Arguments";
-const char kArgumentName[] = "Name";
-const char kArgumentParameter[] = "Parameter";
-const char kArgumentDescription[] = "Description";
-const char versionRegExp[] = "^([0-9]+)(?:[.]([0-9]+))?(?:[.]([0-9]+))?(?:_([0-9]+))?$";
+constexpr char kPluginMetadata[] = "MetaData";
+constexpr char kPluginName[] = "Name";
+constexpr char kPluginVersion[] = "Version";
+constexpr char kPluginCompatversion[] = "CompatVersion";
+constexpr char kPluginRequired[] = "Required";
+constexpr char kPluginExperimental[] = "Experimental";
+constexpr char kPluginDisabledByDefault[] = "DisabledByDefault";
+constexpr char kPluginThreadSafeInitialize[] = "ThreadSafeInitialize";
+constexpr char kPluginThreadSafeShutdown[] = "ThreadSafeShutdown";
+constexpr char kPluginLazy[] = "Lazy";
+constexpr char kPluginDelayedInitializePriority[] = "DelayedInitializePriority";
+constexpr char kPluginInterfaces[] = "Interfaces";
+constexpr char kVendor[] = "Vendor";
+constexpr char kCopyright[] = "Copyright";
+constexpr char kLicense[] = "License";
+constexpr char kDescription[] = "Description";
+constexpr char kLongDescription[] = "LongDescription";
+constexpr char kUrl[] = "Url";
+constexpr char kCategory[] = "Category";
+constexpr char kPlatform[] = "Platform";
+constexpr char kPluginLoadHints[] = "LoadHints";
+constexpr char kLoadHintResolveAllSymbols[] = "ResolveAllSymbols";
+constexpr char kLoadHintExportExternalSymbols[] = "ExportExternalSymbols";
+constexpr char kLoadHintPreventUnload[] = "PreventUnload";
+constexpr char kLoadHintDeepBind[] = "DeepBind";
+constexpr char kDependencies[] = "Dependencies";
+constexpr char kDependencyName[] = "Name";
+constexpr char kDependencyVersion[] = "Version";
+constexpr char kDependencyType[] = "Type";
+constexpr char kDependencyTypeSoft[] = "optional";
+constexpr char kDependencyTypeHard[] = "required";
+constexpr char kDependencyTypeTest[] = "test";
+constexpr char kArguments[] = "Arguments";
+constexpr char kArgumentName[] = "Name";
+constexpr char kArgumentParameter[] = "Parameter";
+constexpr char kArgumentDescription[] = "Description";
 }
 namespace Helpers
 {
@@ -65,6 +82,12 @@ static inline QString msgValueIsNotABool(const char *key)
         .arg(QLatin1String(key));
 }
 
+static inline QString msgValueIsNotAnInteger(const char *key)
+{
+    return Tr::tr("Value for key \"%1\" is not an integer")
+        .arg(QLatin1String(key));
+}
+
 static inline QString msgValueIsNotAObjectArray(const char *key)
 {
     return Tr::tr("Value for key \"%1\" is not an array of objects")
@@ -77,83 +100,425 @@ static inline QString msgValueIsNotAMultilineString(const char *key)
         .arg(QLatin1String(key));
 }
 
+static inline QString msgValueIsNotAStringArray(const char *key)
+{
+    return Tr::tr("Value for key \"%1\" is not an array of strings")
+        .arg(QLatin1String(key));
+}
+
 static inline QString msgInvalidFormat(const char *key, const QString &content)
 {
     return Tr::tr("Value \"%2\" for key \"%1\" has invalid format")
         .arg(QLatin1String(key), content);
 }
 
-static inline bool isValidVersion(const QString &version)
+}
+
+namespace
+{
+enum class MetaDataType : quint8
+{
+    String,
+    Bool,
+    Integer,
+    MultiLineString,
+    StringArray,
+    ObjectArray,
+    Version
+};
+
+struct MetaDataField
+{
+    QLatin1String key;
+    MetaDataType type;
+    bool required;
+    // reported for values of the wrong type instead of the error of the type
+    std::optional<PluginMetaDataError::Kind> typeErrorKind = std::nullopt;
+};
+
+// Errors are reported in table order.
+enum PluginField
+{
+    NameField,
+    VersionField,
+    CompatVersionField,
+    RequiredField,
+    ExperimentalField,
+    DisabledByDefaultField,
+    ThreadSafeInitializeField,
+    ThreadSafeShutdownField,
+    LazyField,
+    DelayedInitializePriorityField,
+    InterfacesField,
+    VendorField,
+    CopyrightField,
+    DescriptionField,
+    LongDescriptionField,
+    UrlField,
+    CategoryField,
+    LicenseField,
+    PlatformField,
+    LoadHintsField,
+    DependenciesField,
+    ArgumentsField,
+    PluginFieldCount
+};
+
+constexpr MetaDataField kPluginSchema[] = {
+    {QLatin1String(Constants::kPluginName), MetaDataType::String, true},
+    {QLatin1String(Constants::kPluginVersion), MetaDataType::Version, true},
+    {QLatin1String(Constants::kPluginCompatversion), MetaDataType::Version, false},
+    {QLatin1String(Constants::kPluginRequired), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginExperimental), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginDisabledByDefault), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginThreadSafeInitialize), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginThreadSafeShutdown), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginLazy), MetaDataType::Bool, false},
+    {QLatin1String(Constants::kPluginDelayedInitializePriority), MetaDataType::Integer, false},
+    {QLatin1String(Constants::kPluginInterfaces), MetaDataType::StringArray, false},
+    {QLatin1String(Constants::kVendor), MetaDataType::String, false},
+    {QLatin1String(Constants::kCopyright), MetaDataType::String, false},
+    {QLatin1String(Constants::kDescription),
+     MetaDataType::MultiLineString,
+     false,
+     PluginMetaDataError::Kind::NotAString},
+    {QLatin1String(Constants::kLongDescription),
+     MetaDataType::MultiLineString,
+     false,
+     PluginMetaDataError::Kind::NotAString},
+    {QLatin1String(Constants::kUrl), MetaDataType::String, false},
+    {QLatin1String(Constants::kCategory), MetaDataType::String, false},
+    {QLatin1String(Constants::kLicense), MetaDataType::MultiLineString, false},
+    {QLatin1String(Constants::kPlatform), MetaDataType::String, false},
+    {QLatin1String(Constants::kPluginLoadHints), MetaDataType::StringArray, false},
+    {QLatin1String(Constants::kDependencies), MetaDataType::ObjectArray, false},
+    {QLatin1String(Constants::kArguments), MetaDataType::ObjectArray, false},
+};
+static_assert(std::size(kPluginSchema) == PluginFieldCount);
+
+enum DependencyField
+{
+    DependencyNameField,
+    DependencyVersionField,
+    DependencyTypeField,
+    DependencyFieldCount
+};
+
+constexpr MetaDataField kDependencySchema[] = {
+    {QLatin1String(Constants::kDependencyName), MetaDataType::String, true},
+    {QLatin1String(Constants::kDependencyVersion), MetaDataType::Version, true},
+    {QLatin1String(Constants::kDependencyType), MetaDataType::String, false},
+};
+static_assert(std::size(kDependencySchema) == DependencyFieldCount);
+
+enum ArgumentField
+{
+    ArgumentNameField,
+    ArgumentParameterField,
+    ArgumentDescriptionField,
+    ArgumentFieldCount
+};
+
+constexpr MetaDataField kArgumentSchema[] = {
+    {QLatin1String(Constants::kArgumentName), MetaDataType::String, true},
+    {QLatin1String(Constants::kArgumentParameter), MetaDataType::String, false},
+    {QLatin1String(Constants::kArgumentDescription), MetaDataType::String, false},
+};
+static_assert(std::size(kArgumentSchema) == ArgumentFieldCount);
+
+bool isArrayOf(const QJsonValue &value, QJsonValue::Type type)
+{
+    if (!value.isArray())
+        return false;
+    const QJsonArray array = value.toArray();
+    for (const QJsonValue &v : array) {
+        if (v.type() != type)
+            return false;
+    }
+    return true;
+}
+
+bool hasType(const QJsonValue &value, MetaDataType type)
 {
-    return QRegularExpression(Constants::versionRegExp).match(version).hasMatch();
+    switch (type) {
+    case MetaDataType::String:
+        return value.isString();
+    case MetaDataType::Bool:
+        return value.isBool();
+    case MetaDataType::Integer:
+        return value.isDouble() && value.toDouble() == value.toInt();
+    case MetaDataType::MultiLineString:
+        return Utils::isMultiLineString(value);
+    case MetaDataType::StringArray:
+        return isArrayOf(value, QJsonValue::String);
+    case MetaDataType::ObjectArray:
+        return isArrayOf(value, QJsonValue::Object);
+    case MetaDataType::Version:
+        return value.isString() && PluginVersion::fromString(value.toString()).has_value();
+    }
+    return false;
+}
+
+PluginMetaDataError typeError(const MetaDataField &field,
+                              const QJsonValue &value,
+                              PluginMetaDataError::Context context)
+{
+    using Kind = PluginMetaDataError::Kind;
+    if (field.typeErrorKind)
+        return {*field.typeErrorKind, context, field.key.data()};
+    switch (field.type) {
+    case MetaDataType::String:
+        return {Kind::NotAString, context, field.key.data()};
+    case MetaDataType::Bool:
+        return {Kind::NotABool, context, field.key.data()};
+    case MetaDataType::Integer:
+        return {Kind::NotAnInteger, context, field.key.data()};
+    case MetaDataType::MultiLineString:
+        return {Kind::NotAMultiLineString, context, field.key.data()};
+    case MetaDataType::StringArray:
+        return {Kind::NotAStringArray, context, field.key.data()};
+    case MetaDataType::ObjectArray:
+        return {Kind::NotAnObjectArray, context, field.key.data()};
+    case MetaDataType::Version:
+        if (value.isString())
+            return {Kind::InvalidFormat, context, field.key.data(), value.toString()};
+        return {Kind::NotAString, context, field.key.data()};
+    }
+    return {Kind::NotAString, context, field.key.data()};
+}
+
+QString fromStringView(std::string_view value)
+{
+    return QString::fromUtf8(value.data(), qsizetype(value.size()));
+}
+
+auto metaDataKey(const QJsonObject::const_iterator &it)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    return it.keyView();
+#else
+    return it.key();
+#endif
 }
 
+// One pass over the object: every known key is type checked and its value put
+// into the slot of its field. Fields with errors are left undefined.
+template<qsizetype N>
+void validate(const QJsonObject &object,
+              const MetaDataField (&schema)[N],
+              QJsonValue (&values)[N],
+              PluginMetaDataError::Context context,
+              QVector<PluginMetaDataError> &errors)
+{
+    bool rejected[N] = {};
+    std::fill(std::begin(values), std::end(values), QJsonValue(QJsonValue::Undefined));
+    for (auto it = object.constBegin(), end = object.constEnd(); it != end; ++it) {
+        const auto key = metaDataKey(it);
+        for (qsizetype i = 0; i < N; ++i) {
+            if (key != schema[i].key)
+                continue;
+            values[i] = it.value();
+            rejected[i] = !hasType(values[i], schema[i].type);
+            break;
+        }
+    }
+    for (qsizetype i = 0; i < N; ++i) {
+        if (rejected[i]) {
+            errors.append(typeError(schema[i], values[i], context));
+            values[i] = QJsonValue(QJsonValue::Undefined);
+        } else if (schema[i].required && values[i].isUndefined()) {
+            errors.append({PluginMetaDataError::Kind::Missing, context, schema[i].key.data()});
+        }
+    }
 }
 
+QString formatMetaDataError(const PluginMetaDataError &error)
+{
+    using Kind = PluginMetaDataError::Kind;
+    QString message;
+    switch (error.kind) {
+    case Kind::Missing:
+        message = Helpers::msgValueMissing(error.key);
+        break;
+    case Kind::NotAString:
+        message = Helpers::msgValueIsNotAString(error.key);
+        break;
+    case Kind::NotABool:
+        message = Helpers::msgValueIsNotABool(error.key);
+        break;
+    case Kind::NotAnInteger:
+        message = Helpers::msgValueIsNotAnInteger(error.key);
+        break;
+    case Kind::NotAMultiLineString:
+        message = Helpers::msgValueIsNotAMultilineString(error.key);
+        break;
+    case Kind::NotAStringArray:
+        message = Helpers::msgValueIsNotAStringArray(error.key);
+        break;
+    case Kind::NotAnObjectArray:
+        message = Helpers::msgValueIsNotAObjectArray(error.key);
+        break;
+    case Kind::InvalidFormat:
+        message = Helpers::msgInvalidFormat(error.key, error.content);
+        break;
+    case Kind::InvalidPlatform:
+        message = ::ExtensionSystem::Tr::tr("Invalid platform specification \"%1\": %2")
+                      .arg(error.content, error.detail);
+        break;
+    case Kind::InvalidDependencyType:
+        message = ::ExtensionSystem::Tr::tr("\"%1\" must be \"%2\" or \"%3\" (is \"%4\").")
+                      .arg(QLatin1String(error.key),
+                           QLatin1String(Constants::kDependencyTypeHard),
+                           QLatin1String(Constants::kDependencyTypeSoft),
+                           error.content);
+        break;
+    case Kind::EmptyArgumentName:
+        message = ::ExtensionSystem::Tr::tr("\"%1\" is empty").arg(QLatin1String(error.key));
+        break;
+    }
+    switch (error.context) {
+    case PluginMetaDataError::Context::Dependency:
+        return ::ExtensionSystem::Tr::tr("Dependency: %1").arg(message);
+    case PluginMetaDataError::Context::Argument:
+        return ::ExtensionSystem::Tr::tr("Argument: %1").arg(message);
+    default:
+        return message;
+    }
+}
+
+} // namespace
+
 
-QString PluginSpecification::name() const
+const QString &PluginSpecification::name() const
 {
     return m_name;
 }
 
-QString PluginSpecification::version() const
+const QString &PluginSpecification::version() const
 {
     return m_version;
 }
 
-QString PluginSpecification::compatVersion() const
+const QString &PluginSpecification::compatVersion() const
 {
     return m_compatVersion;
 }
 
-QString PluginSpecification::vendor() const
+PluginVersion PluginSpecification::versionNumber() const
+{
+    return m_versionNumber;
+}
+
+PluginVersion PluginSpecification::compatVersionNumber() const
+{
+    return m_compatVersionNumber;
+}
+
+bool PluginSpecification::provides(const PluginDependency &dependency) const
+{
+    if (dependency.name.compare(m_name, Qt::CaseInsensitive) != 0)
+        return false;
+    return m_compatVersionNumber <= dependency.version && dependency.version <= m_versionNumber;
+}
+
+const QString &PluginSpecification::vendor() const
 {
     return m_vendor;
 }
 
-QString PluginSpecification::category() const
+const QString &PluginSpecification::category() const
 {
     return m_category;
 }
 
-QString PluginSpecification::description() const
+const QString &PluginSpecification::description() const
 {
-    return m_description;
+    return descriptiveFields().description;
 }
 
-QString PluginSpecification::longDescription() const
+const QString &PluginSpecification::longDescription() const
 {
-    return m_longDescription;
+    return descriptiveFields().longDescription;
 }
 
-QString PluginSpecification::url() const
+const QString &PluginSpecification::url() const
 {
-    return m_url;
+    return descriptiveFields().url;
 }
 
-QString PluginSpecification::revision() const
+const QString &PluginSpecification::revision() const
 {
     return m_revision;
 }
 
-QString PluginSpecification::location() const
+const QString &PluginSpecification::location() const
 {
     return m_location;
 }
 
-QString PluginSpecification::copyright() const
+const QString &PluginSpecification::copyright() const
+{
+    return descriptiveFields().copyright;
+}
+
+const QString &PluginSpecification::license() const
 {
-    return m_copyright;
+    return descriptiveFields().license;
 }
 
-QString PluginSpecification::license() const
+const PluginSpecification::DescriptiveFields &PluginSpecification::descriptiveFields() const
 {
-    return m_license;
+    if (!m_descriptiveFields && m_staticMetaData) {
+        m_descriptiveFields.reset(new DescriptiveFields{fromStringView(m_staticMetaData->description),
+                                                        fromStringView(m_staticMetaData->longDescription),
+                                                        fromStringView(m_staticMetaData->url),
+                                                        fromStringView(m_staticMetaData->copyright),
+                                                        fromStringView(m_staticMetaData->license)});
+    }
+    if (!m_descriptiveFields) {
+        // the types were checked by readMetaData()
+        auto fields = std::make_unique<DescriptiveFields>();
+        const QJsonObject &metaData = this->metaData();
+        Utils::readMultiLineString(metaData.value(QLatin1String(Constants::kDescription)),
+                                   fields->description);
+        Utils::readMultiLineString(metaData.value(QLatin1String(Constants::kLongDescription)),
+                                   fields->longDescription);
+        fields->url = metaData.value(QLatin1String(Constants::kUrl)).toString();
+        fields->copyright = metaData.value(QLatin1String(Constants::kCopyright)).toString();
+        Utils::readMultiLineString(metaData.value(QLatin1String(Constants::kLicense)),
+                                   fields->license);
+        m_descriptiveFields = std::move(fields);
+    }
+    return *m_descriptiveFields;
 }
 
 QRegularExpression PluginSpecification::platformSpecificationRegExp() const
 {
-    return m_platformSpecification;
+    return QRegularExpression(m_platformSpecification);
+}
+
+void PluginSpecification::setPlatformSpecification(const QRegularExpression &platformSpecification)
+{
+    m_platformSpecification = platformSpecification.pattern();
+    m_availableForHostPlatform = matchesHostPlatform(platformSpecification);
+}
+
+bool PluginSpecification::matchesHostPlatform(const QRegularExpression &platformSpecification)
+{
+    return platformSpecification.pattern().isEmpty()
+           || platformSpecification.match(PluginManager::platformName()).hasMatch();
+}
+
+// Names, vendors, categories and locations repeat across specs and dependencies,
+// interned they all share one string.
+QString PluginSpecification::intern(const QString &value)
+{
+    if (value.isEmpty())
+        return QString();
+    static QMutex mutex;
+    static QSet<QString> pool;
+    QMutexLocker locker(&mutex);
+    return *pool.insert(value);
 }
 
 IPlugin *PluginSpecification::plugin() const
@@ -181,8 +546,43 @@ bool PluginSpecification::isEnabledBySettings() const
     return m_enabledBySettings;
 }
 
-QJsonObject PluginSpecification::metaData() const
+bool PluginSpecification::isThreadSafeInitialize() const
+{
+    return m_threadSafeInitialize;
+}
+
+bool PluginSpecification::isThreadSafeShutdown() const
+{
+    return m_threadSafeShutdown;
+}
+
+bool PluginSpecification::isLazy() const
+{
+    return m_lazy;
+}
+
+QLibrary::LoadHints PluginSpecification::loadHints() const
 {
+    return m_loadHints;
+}
+
+int PluginSpecification::delayedInitializePriority() const
+{
+    return m_delayedInitializePriority;
+}
+
+const QStringList &PluginSpecification::interfaces() const
+{
+    return m_interfaces;
+}
+
+const QJsonObject &PluginSpecification::metaData() const
+{
+    // specs restored from the metadata cache only decode their JSON when asked for it
+    if (!m_packedMetaData.isEmpty()) {
+        m_metaData = QCborValue::fromCbor(m_packedMetaData).toMap().toJsonObject();
+        m_packedMetaData.clear();
+    }
     return m_metaData;
 }
 
@@ -191,29 +591,30 @@ PluginState PluginSpecification::state() const
     return m_state;
 }
 
-QVector<PluginDependency> PluginSpecification::dependencies() const
+const QVector<PluginDependency> &PluginSpecification::dependencies() const
 {
     return m_dependencies;
 }
 
-QHash<PluginDependency, PluginSpecification *> PluginSpecification::dependencySpecifications() const
+const QHash<PluginDependency, PluginSpecification *> &
+PluginSpecification::dependencySpecifications() const
 {
     return m_dependencySpecifications;
 }
 
-QStringList PluginSpecification::arguments() const
+const QStringList &PluginSpecification::arguments() const
 {
     return m_arguments;
 }
 
-QVector<PluginArgumentDescription> PluginSpecification::argumentDescriptions() const
+const QVector<PluginArgumentDescription> &PluginSpecification::argumentDescriptions() const
 {
     return m_argumentDescriptions;
 }
 
 bool PluginSpecification::initializeExtensions()
 {
-    if (m_errorString)
+    if (hasError())
         return false;
     if (m_state != PluginState::Initialized) {
         if (m_state == PluginState::Running)
@@ -241,44 +642,179 @@ bool PluginSpecification::read(const QString &filePath)
 {
     reset();
     QFileInfo fileInfo(filePath);
-    m_location = fileInfo.absolutePath();
+    m_location = intern(fileInfo.absolutePath());
     m_filePath = fileInfo.absoluteFilePath();
-    m_loader.emplace();
-    if (Utils::HostInfo::isMacHost())
-        m_loader->setLoadHints(QLibrary::ExportExternalSymbolsHint);
-    m_loader->setFileName(filePath);
+    if (Utils::HostInfo::isLinuxHost()) {
+        // reject foreign libraries before QPluginLoader opens them and decodes their metadata
+        const QByteArray pluginIID = PluginManager::instance().pluginIID().toUtf8();
+        switch (probeElfPlugin(m_filePath, pluginIID)) {
+        case PluginProbeResult::NotAPlugin:
+            qCDebug(pluginLog) << "Not a plugin (no Qt plugin metadata found)";
+            return false;
+        case PluginProbeResult::IidMismatch:
+            qCDebug(pluginLog) << "Plugin ignored (IID does not match)";
+            return false;
+        default:
+            break;
+        }
+    }
+    createLoader();
     if (m_loader->fileName().isEmpty()) {
         return false;
     }
 
     if (!readMetaData(m_loader->metaData()))
         return false;
+    // the loader was needed for the metadata before the hints were known
+    m_loader->setLoadHints(libraryLoadHints());
+
+    m_state = PluginState::Read;
+    return true;
+}
+
+// Static plugins are linked into the application, their metadata comes with them and
+// loadLibrary() only has to create the instance.
+bool PluginSpecification::read(const QStaticPlugin &plugin)
+{
+    reset();
+    m_staticPlugin = plugin;
+    if (!readMetaData(plugin.metaData()))
+        return false;
+
+    m_state = PluginState::Read;
+    return true;
+}
+
+// The compiler has checked the metadata, it only has to be taken over.
+bool PluginSpecification::read(const StaticPluginMetaData &metaData)
+{
+    reset();
+    m_staticMetaData = &metaData;
+    m_name = intern(fromStringView(metaData.name));
+    m_versionNumber = metaData.version;
+    m_version = m_versionNumber.toString();
+    m_compatVersionNumber = metaData.compatVersion.value_or(metaData.version);
+    m_compatVersion = m_compatVersionNumber.toString();
+    m_vendor = intern(fromStringView(metaData.vendor));
+    m_category = intern(fromStringView(metaData.category));
+    m_required = metaData.required;
+    m_experimental = metaData.experimental;
+    m_enabledByDefault = !metaData.disabledByDefault && !m_experimental;
+    m_enabledBySettings = m_enabledByDefault;
+    m_threadSafeInitialize = metaData.threadSafeInitialize;
+    m_threadSafeShutdown = metaData.threadSafeShutdown;
+    m_lazy = metaData.lazy;
+    m_delayedInitializePriority = metaData.delayedInitializePriority;
+    m_interfaces.reserve(qsizetype(metaData.interfaces.size()));
+    for (std::string_view interfaceName : metaData.interfaces)
+        m_interfaces.append(fromStringView(interfaceName));
+
+    const QString platformSpec = fromStringView(metaData.platform).trimmed();
+    if (!platformSpec.isEmpty()) {
+        const QRegularExpression platformSpecification(platformSpec);
+        if (platformSpecification.isValid()) {
+            setPlatformSpecification(platformSpecification);
+        } else {
+            m_metaDataErrors.append({PluginMetaDataError::Kind::InvalidPlatform,
+                                     PluginMetaDataError::Context::Plugin,
+                                     Constants::kPlatform,
+                                     platformSpec,
+                                     platformSpecification.errorString()});
+        }
+    }
+
+    m_dependencies.reserve(qsizetype(metaData.dependencies.size()));
+    for (const StaticPluginDependency &dependency : metaData.dependencies) {
+        PluginDependency dep;
+        dep.name = intern(fromStringView(dependency.name));
+        dep.version = dependency.version;
+        dep.type = dependency.type;
+        m_dependencies.append(dep);
+    }
+    m_argumentDescriptions.reserve(qsizetype(metaData.arguments.size()));
+    for (const StaticPluginArgument &argument : metaData.arguments) {
+        m_argumentDescriptions.append({fromStringView(argument.name),
+                                       fromStringView(argument.parameter),
+                                       fromStringView(argument.description)});
+    }
 
     m_state = PluginState::Read;
     return true;
 }
 
+bool PluginSpecification::isStaticPlugin() const
+{
+    return m_staticPlugin || m_staticMetaData;
+}
+
+void PluginSpecification::createLoader()
+{
+    m_loader.emplace();
+    m_loader->setLoadHints(libraryLoadHints());
+    m_loader->setFileName(m_filePath);
+}
+
+QLibrary::LoadHints PluginSpecification::libraryLoadHints() const
+{
+    QLibrary::LoadHints loadHints = m_loadHints;
+    if (Utils::HostInfo::isMacHost())
+        loadHints |= QLibrary::ExportExternalSymbolsHint;
+    return loadHints;
+}
+
+void PluginSpecification::preloadLibrary(QThread *ownerThread)
+{
+    // Runs on a worker thread ahead of loadLibrary(): only maps and links the library,
+    // the plugin instance and the state change are left to loadLibrary().
+    if (m_loader) {
+        m_loader->load();
+        return;
+    }
+    createLoader();
+    m_loader->load();
+    m_loader->moveToThread(ownerThread);
+}
+
+// Takes a killed plugin back to Read, ready to be resolved and loaded again. Errors
+// found in the metadata stay, the plugin cannot be resolved with them.
+void PluginSpecification::unloadLibrary()
+{
+    if (m_plugin)
+        return;
+    if (m_loader && m_loader->isLoaded())
+        m_loader->unload();
+    m_errorString.reset();
+    m_state = PluginState::Read;
+}
+
 void PluginSpecification::reset()
 {
     m_name.clear();
     m_version.clear();
     m_compatVersion.clear();
+    m_versionNumber = PluginVersion();
+    m_compatVersionNumber = PluginVersion();
     m_vendor.clear();
     m_category.clear();
-    m_description.clear();
-    m_longDescription.clear();
-    m_url.clear();
     m_revision.clear();
     m_location.clear();
     m_filePath.clear();
-    m_platformSpecification.setPattern(QString());
-    m_copyright.clear();
-    m_license.clear();
+    m_platformSpecification.clear();
+    m_availableForHostPlatform.reset();
+    m_descriptiveFields.reset();
     m_plugin = nullptr;
     m_required = false;
     m_experimental = false;
     m_enabledByDefault = true;
+    m_threadSafeInitialize = false;
+    m_threadSafeShutdown = false;
+    m_lazy = false;
+    m_outdated = false;
+    m_loadHints = {};
+    m_delayedInitializePriority = 0;
+    m_interfaces.clear();
     m_metaData = QJsonObject();
+    m_packedMetaData.clear();
     m_state = PluginState::Invalid;
     m_dependencies.clear();
     m_dependencySpecifications.clear();
@@ -286,12 +822,15 @@ void PluginSpecification::reset()
     m_argumentDescriptions.clear();
     m_loader.reset();
     m_errorString.reset();
+    m_metaDataErrorString.clear();
+    m_metaDataErrors.clear();
     m_staticPlugin.reset();
+    m_staticMetaData = nullptr;
 }
 
 bool PluginSpecification::loadLibrary()
 {
-    if (m_errorString.has_value())
+    if (hasError())
         return false;
     if (m_state != PluginState::Resolved) {
         if (m_state == PluginState::Loaded)
@@ -300,13 +839,21 @@ bool PluginSpecification::loadLibrary()
             ::ExtensionSystem::Tr::tr("Loading the library failed because state != Resolved");
         return false;
     }
+    if (!m_loader && !isStaticPlugin())
+        createLoader();
     if (m_loader && !m_loader->load()) {
         m_errorString = QDir::toNativeSeparators(m_filePath) + QString::fromLatin1(": ")
                       + m_loader->errorString();
         return false;
     }
-    auto *pluginObject = m_loader ? qobject_cast<IPlugin *>(m_loader->instance())
-                                : qobject_cast<IPlugin *>(m_staticPlugin->instance());
+    QObject *instance = nullptr;
+    if (m_loader)
+        instance = m_loader->instance();
+    else if (m_staticPlugin)
+        instance = m_staticPlugin->instance();
+    else
+        instance = m_staticMetaData->instance();
+    auto *pluginObject = qobject_cast<IPlugin *>(instance);
     if (!pluginObject) {
         m_errorString =
             ::ExtensionSystem::Tr::tr("Plugin is not valid (does not derive from IPlugin)");
@@ -321,6 +868,9 @@ bool PluginSpecification::loadLibrary()
 
 bool PluginSpecification::readMetaData(const QJsonObject &pluginMetaData)
 {
+    PluginProfiler::Scope profile(PluginManager::instance().profiler(),
+                                  ProfilePhase::ParseMetaData,
+                                  m_filePath);
     qCDebug(pluginLog) << "MetaData:" << QJsonDocument(pluginMetaData).toJson();
     QJsonValue value;
     value = pluginMetaData.value(QLatin1String("IID"));
@@ -335,209 +885,181 @@ bool PluginSpecification::readMetaData(const QJsonObject &pluginMetaData)
 
     value = pluginMetaData.value(QLatin1String(Constants::kPluginMetadata));
     if (!value.isObject()) {
-        return reportError(::ExtensionSystem::Tr::tr("Plugin meta data not found"));
+        m_metaDataErrorString = ::ExtensionSystem::Tr::tr("Plugin meta data not found");
+        return true;
     }
     m_metaData = value.toObject();
 
-    value = m_metaData.value(QLatin1String(Constants::kPluginName));
-    if (value.isUndefined())
-        return reportError(Helpers::msgValueMissing(Constants::kPluginName));
-    if (!value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kPluginName));
-    m_name = value.toString();
-
-    value = m_metaData.value(QLatin1String(Constants::kPluginVersion));
-    if (value.isUndefined())
-        return reportError(Helpers::msgValueMissing(Constants::kPluginVersion));
-    if (!value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kPluginVersion));
-    m_version = value.toString();
-    if (!Helpers::isValidVersion(m_version))
-        return reportError(Helpers::msgInvalidFormat(Constants::kPluginVersion, m_version));
-
-    value = m_metaData.value(QLatin1String(Constants::kPluginCompatversion));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kPluginCompatversion));
-    m_compatVersion = value.toString(m_version);
-    if (!value.isUndefined() && !Helpers::isValidVersion(m_compatVersion))
-        return reportError(Helpers::msgInvalidFormat(Constants::kPluginCompatversion, m_compatVersion));
-
-    value = m_metaData.value(QLatin1String(Constants::kPluginRequired));
-    if (!value.isUndefined() && !value.isBool())
-        return reportError(Helpers::msgValueIsNotABool(Constants::kPluginRequired));
-    m_required = value.toBool(false);
-    qCDebug(pluginLog) << "required = " << m_required;
-
-    value = m_metaData.value(QLatin1String(Constants::kPluginExperimental));
-    if (!value.isUndefined() && !value.isBool())
-        return reportError(Helpers::msgValueIsNotABool(Constants::kPluginExperimental));
-    m_experimental = value.toBool(false);
-    qCDebug(pluginLog) << "experimental = " << m_experimental;
-
-    value = m_metaData.value(QLatin1String(Constants::kPluginDisabledByDefault));
-    if (!value.isUndefined() && !value.isBool())
-        return reportError(Helpers::msgValueIsNotABool(Constants::kPluginDisabledByDefault));
-    m_enabledByDefault = !value.toBool(false);
-    qCDebug(pluginLog) << "enabledByDefault = " << m_enabledByDefault;
-
-    if (m_experimental)
-        m_enabledByDefault = false;
+    // Every problem is collected, fields that passed validation are taken over
+    // even if others did not.
+    using Context = PluginMetaDataError::Context;
+    QJsonValue values[PluginFieldCount];
+    validate(m_metaData, kPluginSchema, values, Context::Plugin, m_metaDataErrors);
+
+    m_name = intern(values[NameField].toString());
+    profile.setPluginName(m_name);
+    if (!values[VersionField].isUndefined()) {
+        m_version = values[VersionField].toString();
+        m_versionNumber = *PluginVersion::fromString(m_version);
+    }
+    m_compatVersion = m_version;
+    m_compatVersionNumber = m_versionNumber;
+    if (!values[CompatVersionField].isUndefined()) {
+        m_compatVersion = values[CompatVersionField].toString();
+        m_compatVersionNumber = *PluginVersion::fromString(m_compatVersion);
+    }
+    m_required = values[RequiredField].toBool(false);
+    m_experimental = values[ExperimentalField].toBool(false);
+    m_enabledByDefault = !values[DisabledByDefaultField].toBool(false) && !m_experimental;
     m_enabledBySettings = m_enabledByDefault;
-
-    value = m_metaData.value(QLatin1String(Constants::kVendor));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kVendor));
-    m_vendor = value.toString();
-
-    value = m_metaData.value(QLatin1String(Constants::kCopyright));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kCopyright));
-    m_copyright = value.toString();
-
-    value = m_metaData.value(QLatin1String(Constants::kDescription));
-    if (!value.isUndefined() && !Utils::readMultiLineString(value, m_description))
-        return reportError(Helpers::msgValueIsNotAString(Constants::kDescription));
-
-    value = m_metaData.value(QLatin1String(Constants::kLongDescription));
-    if (!value.isUndefined() && !Utils::readMultiLineString(value, m_longDescription))
-        return reportError(Helpers::msgValueIsNotAString(Constants::kLongDescription));
-
-    value = m_metaData.value(QLatin1String(Constants::kUrl));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kUrl));
-    m_url = value.toString();
-
-    value = m_metaData.value(QLatin1String(Constants::kCategory));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kCategory));
-    m_category = value.toString();
-
-    value = m_metaData.value(QLatin1String(Constants::kLicense));
-    if (!value.isUndefined() && !Utils::readMultiLineString(value, m_license))
-        return reportError(Helpers::msgValueIsNotAMultilineString(Constants::kLicense));
-
-    value = m_metaData.value(QLatin1String(Constants::kPlatform));
-    if (!value.isUndefined() && !value.isString())
-        return reportError(Helpers::msgValueIsNotAString(Constants::kPlatform));
-    const QString platformSpec = value.toString().trimmed();
+    m_threadSafeInitialize = values[ThreadSafeInitializeField].toBool(false);
+    m_threadSafeShutdown = values[ThreadSafeShutdownField].toBool(false);
+    m_lazy = values[LazyField].toBool(false);
+    m_delayedInitializePriority = values[DelayedInitializePriorityField].toInt(0);
+    const QJsonArray interfaces = values[InterfacesField].toArray();
+    m_interfaces.reserve(interfaces.size());
+    for (const QJsonValue &v : interfaces)
+        m_interfaces.append(v.toString());
+    m_vendor = intern(values[VendorField].toString());
+    m_category = intern(values[CategoryField].toString());
+
+    const QString platformSpec = values[PlatformField].toString().trimmed();
     if (!platformSpec.isEmpty()) {
-        m_platformSpecification.setPattern(platformSpec);
-        if (!m_platformSpecification.isValid()) {
-            return reportError(::ExtensionSystem::Tr::tr("Invalid platform specification \"%1\": %2")
-                                   .arg(platformSpec, m_platformSpecification.errorString()));
+        const QRegularExpression platformSpecification(platformSpec);
+        if (platformSpecification.isValid()) {
+            setPlatformSpecification(platformSpecification);
+        } else {
+            m_metaDataErrors.append({PluginMetaDataError::Kind::InvalidPlatform,
+                                     Context::Plugin,
+                                     Constants::kPlatform,
+                                     platformSpec,
+                                     platformSpecification.errorString()});
         }
     }
 
-    value = m_metaData.value(QLatin1String(Constants::kDependencies));
-    if (!value.isUndefined() && !value.isArray())
-        return reportError(Helpers::msgValueIsNotAObjectArray(Constants::kDependencies));
-    if (!value.isUndefined()) {
-        const QJsonArray array = value.toArray();
-        for (const QJsonValue &v : array) {
-            if (!v.isObject())
-                return reportError(Helpers::msgValueIsNotAObjectArray(Constants::kDependencies));
-            QJsonObject dependencyObject = v.toObject();
-            PluginDependency dep;
-            value = dependencyObject.value(QLatin1String(Constants::kDependencyName));
-            if (value.isUndefined()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Dependency: %1")
-                        .arg(Helpers::msgValueMissing(Constants::kDependencyName)));
-            }
-            if (!value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Dependency: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kDependencyName)));
-            }
-            dep.name = value.toString();
-            value = dependencyObject.value(QLatin1String(Constants::kDependencyVersion));
-            if (!value.isUndefined() && !value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Dependency: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kDependencyVersion)));
-            }
-            dep.version = value.toString();
-            if (!Helpers::isValidVersion(dep.version)) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Dependency: %1")
-                        .arg(Helpers::msgInvalidFormat(Constants::kDependencyVersion, dep.version)));
-            }
-            dep.type = PluginDependency::Type::Required;
-            value = dependencyObject.value(QLatin1String(Constants::kDependencyType));
-            if (!value.isUndefined() && !value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Dependency: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kDependencyType)));
-            }
-            if (!value.isUndefined()) {
-                const QString typeValue = value.toString();
-                if (typeValue.toLower() == QLatin1String(Constants::kDependencyTypeHard)) {
-                    dep.type = PluginDependency::Type::Required;
-                } else if (typeValue.toLower() == QLatin1String(Constants::kDependencyTypeSoft)) {
-                    dep.type = PluginDependency::Type::Optional;
-                } else if (typeValue.toLower() == QLatin1String(Constants::kDependencyTypeTest)) {
-                    dep.type = PluginDependency::Type::Test;
-                } else {
-                    return reportError(
-                        ::ExtensionSystem::Tr::tr(
-                            "Dependency: \"%1\" must be \"%2\" or \"%3\" (is \"%4\").")
-                            .arg(QLatin1String(Constants::kDependencyType),
-                                 QLatin1String(Constants::kDependencyTypeHard),
-                                 QLatin1String(Constants::kDependencyTypeSoft),
-                                 typeValue));
-                }
-            }
-            m_dependencies.append(dep);
+    // binding and symbol visibility of the library, lazy binding unless asked otherwise
+    const QJsonArray loadHints = values[LoadHintsField].toArray();
+    for (const QJsonValue &v : loadHints) {
+        const QString hint = v.toString();
+        if (hint == QLatin1String(Constants::kLoadHintResolveAllSymbols)) {
+            m_loadHints |= QLibrary::ResolveAllSymbolsHint;
+        } else if (hint == QLatin1String(Constants::kLoadHintExportExternalSymbols)) {
+            m_loadHints |= QLibrary::ExportExternalSymbolsHint;
+        } else if (hint == QLatin1String(Constants::kLoadHintPreventUnload)) {
+            m_loadHints |= QLibrary::PreventUnloadHint;
+        } else if (hint == QLatin1String(Constants::kLoadHintDeepBind)) {
+            m_loadHints |= QLibrary::DeepBindHint;
+        } else {
+            m_metaDataErrors.append({PluginMetaDataError::Kind::InvalidFormat,
+                                     Context::Plugin,
+                                     Constants::kPluginLoadHints,
+                                     hint});
         }
     }
 
-    value = m_metaData.value(QLatin1String(Constants::kArguments));
-    if (!value.isUndefined() && !value.isArray())
-        return reportError(Helpers::msgValueIsNotAObjectArray(Constants::kArguments));
-    if (!value.isUndefined()) {
-        const QJsonArray array = value.toArray();
-        for (const QJsonValue &v : array) {
-            if (!v.isObject())
-                return reportError(Helpers::msgValueIsNotAObjectArray(Constants::kArguments));
-            QJsonObject argumentObject = v.toObject();
-            PluginArgumentDescription arg;
-            value = argumentObject.value(QLatin1String(Constants::kArgumentName));
-            if (value.isUndefined()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Argument: %1")
-                        .arg(Helpers::msgValueMissing(Constants::kArgumentName)));
+    const QJsonArray dependencies = values[DependenciesField].toArray();
+    m_dependencies.reserve(dependencies.size());
+    for (const QJsonValue &v : dependencies) {
+        const qsizetype errorCount = m_metaDataErrors.size();
+        QJsonValue depValues[DependencyFieldCount];
+        validate(v.toObject(), kDependencySchema, depValues, Context::Dependency, m_metaDataErrors);
+        PluginDependency dep;
+        dep.type = PluginDependency::Type::Required;
+        if (!depValues[DependencyTypeField].isUndefined()) {
+            const QString typeValue = depValues[DependencyTypeField].toString();
+            if (typeValue.compare(QLatin1String(Constants::kDependencyTypeHard), Qt::CaseInsensitive) == 0) {
+                dep.type = PluginDependency::Type::Required;
+            } else if (typeValue.compare(QLatin1String(Constants::kDependencyTypeSoft), Qt::CaseInsensitive) == 0) {
+                dep.type = PluginDependency::Type::Optional;
+            } else if (typeValue.compare(QLatin1String(Constants::kDependencyTypeTest), Qt::CaseInsensitive) == 0) {
+                dep.type = PluginDependency::Type::Test;
+            } else {
+                m_metaDataErrors.append({PluginMetaDataError::Kind::InvalidDependencyType,
+                                         Context::Dependency,
+                                         Constants::kDependencyType,
+                                         typeValue});
             }
-            if (!value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Argument: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kArgumentName)));
-            }
-            arg.name = value.toString();
-            if (arg.name.isEmpty()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Argument: \"%1\" is empty")
-                        .arg(QLatin1String(Constants::kArgumentName)));
-            }
-            value = argumentObject.value(QLatin1String(Constants::kArgumentDescription));
-            if (!value.isUndefined() && !value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Argument: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kArgumentDescription)));
+        }
+        if (m_metaDataErrors.size() != errorCount)
+            continue;
+        dep.name = intern(depValues[DependencyNameField].toString());
+        dep.version = *PluginVersion::fromString(depValues[DependencyVersionField].toString());
+        m_dependencies.append(dep);
+    }
+
+    const QJsonArray arguments = values[ArgumentsField].toArray();
+    m_argumentDescriptions.reserve(arguments.size());
+    for (const QJsonValue &v : arguments) {
+        const qsizetype errorCount = m_metaDataErrors.size();
+        QJsonValue argValues[ArgumentFieldCount];
+        validate(v.toObject(), kArgumentSchema, argValues, Context::Argument, m_metaDataErrors);
+        PluginArgumentDescription arg;
+        arg.name = argValues[ArgumentNameField].toString();
+        if (!argValues[ArgumentNameField].isUndefined() && arg.name.isEmpty()) {
+            m_metaDataErrors.append({PluginMetaDataError::Kind::EmptyArgumentName,
+                                     Context::Argument,
+                                     Constants::kArgumentName});
+        }
+        if (m_metaDataErrors.size() != errorCount)
+            continue;
+        arg.parameter = argValues[ArgumentParameterField].toString();
+        arg.description = argValues[ArgumentDescriptionField].toString();
+        m_argumentDescriptions.append(arg);
+    }
+
+    return true;
+}
+
+// specsByName is keyed by case folded plugin name
+bool PluginSpecification::resolveDependencies(
+    const QHash<QString, QVector<PluginSpecification *>> &specsByName)
+{
+    if (hasError())
+        return false;
+    if (m_state == PluginState::Resolved)
+        m_state = PluginState::Read; // Go back, so we just re-resolve the dependencies.
+    if (m_state != PluginState::Read) {
+        m_errorString = ::ExtensionSystem::Tr::tr(
+            "Resolving dependencies failed because state != Read");
+        return false;
+    }
+
+    QHash<PluginDependency, PluginSpecification *> resolvedDependencies;
+    resolvedDependencies.reserve(m_dependencies.size());
+    for (const PluginDependency &dependency : std::as_const(m_dependencies)) {
+        // several versions of a plugin may be installed, take the newest one that
+        // fits, preferring the ones that were read without error
+        PluginSpecification *found = nullptr;
+        const auto candidates = specsByName.constFind(dependency.name.toCaseFolded());
+        if (candidates != specsByName.cend()) {
+            for (PluginSpecification *candidate : *candidates) {
+                if (candidate == this || !candidate->provides(dependency))
+                    continue;
+                if (!found || (found->hasError() && !candidate->hasError())
+                    || (found->hasError() == candidate->hasError()
+                        && found->m_versionNumber < candidate->m_versionNumber)) {
+                    found = candidate;
+                }
             }
-            arg.description = value.toString();
-            value = argumentObject.value(QLatin1String(Constants::kArgumentParameter));
-            if (!value.isUndefined() && !value.isString()) {
-                return reportError(
-                    ::ExtensionSystem::Tr::tr("Argument: %1")
-                        .arg(Helpers::msgValueIsNotAString(Constants::kArgumentParameter)));
+        }
+        if (!found) {
+            if (dependency.type == PluginDependency::Type::Required) {
+                if (m_errorString)
+                    m_errorString->append(QLatin1Char('\n'));
+                else
+                    m_errorString = QString();
+                m_errorString->append(::ExtensionSystem::Tr::tr("Could not resolve dependency '%1(%2)'")
+                                          .arg(dependency.name, dependency.version.toString()));
             }
-            arg.parameter = value.toString();
-            m_argumentDescriptions.append(arg);
-            qCDebug(pluginLog) << "Argument:" << arg.name << "Parameter:" << arg.parameter
-                               << "Description:" << arg.description;
+            continue;
         }
+        resolvedDependencies.insert(dependency, found);
     }
+    if (hasError())
+        return false;
 
+    m_dependencySpecifications = resolvedDependencies;
+    m_state = PluginState::Resolved;
     return true;
 }
 
@@ -547,21 +1069,41 @@ bool PluginSpecification::reportError(const QString &errorString)
     return true;
 }
 
+// Metadata errors are kept apart from those of resolving and loading, which are
+// dropped when the plugin goes back to Read, see unloadLibrary().
 std::optional<QString> PluginSpecification::errorString() const
 {
-    return m_errorString;
+    if (m_metaDataErrorString.isEmpty() && m_metaDataErrors.isEmpty())
+        return m_errorString;
+    QString message = metaDataErrorString();
+    if (m_errorString)
+        message += QLatin1Char('\n') + *m_errorString;
+    return message;
+}
+
+QString PluginSpecification::metaDataErrorString() const
+{
+    QStringList messages;
+    if (!m_metaDataErrorString.isEmpty())
+        messages.append(m_metaDataErrorString);
+    for (const PluginMetaDataError &error : m_metaDataErrors)
+        messages.append(formatMetaDataError(error));
+    return messages.join(QLatin1Char('\n'));
 }
 
 bool PluginSpecification::hasError() const
 {
-    return m_errorString.has_value();
+    return m_errorString.has_value() || !m_metaDataErrorString.isEmpty()
+           || !m_metaDataErrors.isEmpty();
 }
 
 
 bool PluginSpecification::isAvailableForHostPlatform() const
 {
-    return m_platformSpecification.pattern().isEmpty()
-           || m_platformSpecification.match(PluginManager::platformName()).hasMatch();
+    // the host platform does not change, so match only once
+    if (!m_availableForHostPlatform)
+        m_availableForHostPlatform = matchesHostPlatform(platformSpecificationRegExp());
+    return *m_availableForHostPlatform;
 }
 
 bool PluginSpecification::isEffectivelyEnabled() const
@@ -572,6 +1114,11 @@ bool PluginSpecification::isEffectivelyEnabled() const
     return isEnabledBySettings();
 }
 
+bool PluginSpecification::isOutdated() const
+{
+    return m_outdated;
+}
+
 void PluginSpecification::kill()
 {
     if (!m_plugin)
@@ -583,7 +1130,7 @@ void PluginSpecification::kill()
 
 bool PluginSpecification::initializePlugin()
 {
-    if (m_errorString.has_value())
+    if (hasError())
         return false;
     if (m_state != PluginState::Loaded) {
         if (m_state == PluginState::Initialized)
@@ -616,7 +1163,7 @@ PluginShutdownFlag PluginSpecification::stop()
 
 bool PluginSpecification::delayedInitialize()
 {
-    if (m_errorString.has_value())
+    if (hasError())
         return false;
     if (m_state != PluginState::Running)
         return false;
@@ -634,6 +1181,16 @@ bool PluginDependency::operator==(const PluginDependency &other) const
     return name == other.name && version == other.version && type == other.type;
 }
 
+QString PluginDependency::toString() const
+{
+    QString result = name + QLatin1String(" (") + version.toString();
+    if (type == Type::Optional)
+        result += QLatin1String(", optional");
+    else if (type == Type::Test)
+        result += QLatin1String(", test");
+    return result + QLatin1Char(')');
+}
+
 size_t qHash(const PluginDependency &value)
 {
     return qHash(value.name);
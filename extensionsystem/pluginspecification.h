@@ -3,13 +3,19 @@
 #include <QVector>
 #include <QStringList>
 #include <QHash>
+#include <memory>
 #include <optional>
 #include <QPluginLoader>
 #include <QJsonObject>
+#include <QRegularExpression>
 #include "extensionsystemglobal.h"
+#include "iplugin.h"
+#include "pluginversion.h"
 
 
 namespace ExtensionSystem {
+struct StaticPluginMetaData;
+
 enum PluginState
 {
     Invalid,
@@ -35,12 +41,42 @@ struct PluginDependency
     friend size_t qHash(const PluginDependency &value);
 
     QString name;
-    QString version;
+    PluginVersion version;
     Type type;
     bool operator==(const PluginDependency &other) const;
     QString toString() const;
 };
 
+// A problem found while validating plugin metadata. It is only put into words
+// when somebody reads the error string.
+struct PluginMetaDataError
+{
+    enum class Kind : quint8 {
+        Missing,
+        NotAString,
+        NotABool,
+        NotAnInteger,
+        NotAMultiLineString,
+        NotAStringArray,
+        NotAnObjectArray,
+        InvalidFormat,
+        InvalidPlatform,
+        InvalidDependencyType,
+        EmptyArgumentName
+    };
+    enum class Context : quint8 {
+        Plugin,
+        Dependency,
+        Argument
+    };
+
+    Kind kind;
+    Context context;
+    const char *key;
+    QString content;
+    QString detail;
+};
+
 struct EXTENSIONSYSTEM_EXPORT PluginArgumentDescription
 {
     QString name;
@@ -52,35 +88,46 @@ class IPlugin;
 class EXTENSIONSYSTEM_EXPORT PluginSpecification
 {
 public:
-    QString name() const;
-    QString version() const;
-    QString compatVersion() const;
-    QString vendor() const;
-    QString category() const;
-    QString description() const;
-    QString longDescription() const;
-    QString url() const;
-    QString revision() const;
-    QString location() const;
-    QString copyright() const;
-    QString license() const;
+    const QString &name() const;
+    const QString &version() const;
+    const QString &compatVersion() const;
+    PluginVersion versionNumber() const;
+    PluginVersion compatVersionNumber() const;
+    bool provides(const PluginDependency &dependency) const;
+    const QString &vendor() const;
+    const QString &category() const;
+    const QString &description() const;
+    const QString &longDescription() const;
+    const QString &url() const;
+    const QString &revision() const;
+    const QString &location() const;
+    const QString &copyright() const;
+    const QString &license() const;
     QRegularExpression platformSpecificationRegExp() const;
     IPlugin *plugin() const;
     bool isRequired() const;
     bool isExperimental() const;
     bool isEnabledByDefault() const;
     bool isEnabledBySettings() const;
-    QJsonObject metaData() const;
+    bool isThreadSafeInitialize() const;
+    bool isThreadSafeShutdown() const;
+    bool isLazy() const;
+    QLibrary::LoadHints loadHints() const;
+    int delayedInitializePriority() const;
+    const QStringList &interfaces() const;
+    const QJsonObject &metaData() const;
     PluginState state() const;
-    QVector<PluginDependency> dependencies() const;
-    QHash<PluginDependency, PluginSpecification *> dependencySpecifications() const;
-    QStringList arguments() const;
-    QVector<PluginArgumentDescription> argumentDescriptions() const;
+    const QVector<PluginDependency> &dependencies() const;
+    const QHash<PluginDependency, PluginSpecification *> &dependencySpecifications() const;
+    const QStringList &arguments() const;
+    const QVector<PluginArgumentDescription> &argumentDescriptions() const;
 
     bool initializeExtensions();
 
     void addArguments(const QStringList &arguments);
     bool read(const QString &filePath);
+    bool read(const QStaticPlugin &plugin);
+    bool read(const StaticPluginMetaData &metaData);
     void reset();
     bool loadLibrary();
 
@@ -89,42 +136,82 @@ public:
 
     bool isAvailableForHostPlatform() const;
     bool isEffectivelyEnabled() const;
+    // the library changed or went away on disk while its code was in use
+    bool isOutdated() const;
     void kill();
     bool initializePlugin();
-    IPlugin::ShutdownFlag stop();
+    PluginShutdownFlag stop();
+    bool delayedInitialize();
 private:
     friend class PluginManager;
+    friend class PluginMetaDataCache;
+    friend class PluginStartupSnapshot;
     bool readMetaData(const QJsonObject &pluginMetaData);
+    bool resolveDependencies(const QHash<QString, QVector<PluginSpecification *>> &specsByName);
+    void setPlatformSpecification(const QRegularExpression &platformSpecification);
+    static bool matchesHostPlatform(const QRegularExpression &platformSpecification);
+    static QString intern(const QString &value);
+
+    // descriptive fields are not needed to load plugins, they are decoded from the
+    // metadata when first asked for
+    struct DescriptiveFields
+    {
+        QString description;
+        QString longDescription;
+        QString url;
+        QString copyright;
+        QString license;
+    };
+    const DescriptiveFields &descriptiveFields() const;
+
+    bool isStaticPlugin() const;
+    void createLoader();
+    QLibrary::LoadHints libraryLoadHints() const;
+    void preloadLibrary(QThread *ownerThread);
+    void unloadLibrary();
     bool reportError(const QString &errorString);
+    QString metaDataErrorString() const;
     QString m_name;
     QString m_version;
     QString m_compatVersion;
+    PluginVersion m_versionNumber;
+    PluginVersion m_compatVersionNumber;
     QString m_vendor;
     QString m_category;
-    QString m_description;
-    QString m_longDescription;
-    QString m_url;
     QString m_revision;
     QString m_location;
     QString m_filePath;
-    QString m_copyright;
-    QString m_license;
-    QRegularExpression m_platformSpecification;
-    IPlugin *m_plugin;
+    QString m_platformSpecification;
+    mutable std::unique_ptr<const DescriptiveFields> m_descriptiveFields;
+    IPlugin *m_plugin = nullptr;
     bool m_required = false;
     bool m_experimental = false;
     bool m_enabledByDefault = true;
     bool m_enabledBySettings = true;
-    QJsonObject m_metaData;
-    PluginState m_state;
+    // matched against the host platform when first needed
+    mutable std::optional<bool> m_availableForHostPlatform;
+    bool m_threadSafeInitialize = false;
+    bool m_threadSafeShutdown = false;
+    bool m_lazy = false;
+    bool m_outdated = false;
+    QLibrary::LoadHints m_loadHints;
+    int m_delayedInitializePriority = 0;
+    QStringList m_interfaces;
+    mutable QJsonObject m_metaData;
+    mutable QByteArray m_packedMetaData;
+    QVector<PluginMetaDataError> m_metaDataErrors;
+    // metadata errors that are already put into words, e.g. taken from the metadata cache
+    QString m_metaDataErrorString;
+    PluginState m_state = PluginState::Invalid;
     QVector<PluginDependency> m_dependencies;
     QHash<PluginDependency, PluginSpecification *> m_dependencySpecifications;
     QStringList m_arguments;
     QVector<PluginArgumentDescription> m_argumentDescriptions;
     std::optional<QPluginLoader> m_loader;
-    std::optional<QString> m_errorString;
+    mutable std::optional<QString> m_errorString;
 
     std::optional<QStaticPlugin> m_staticPlugin;
+    const StaticPluginMetaData *m_staticMetaData = nullptr;
 };
 
 } // namespace ExtensionSystem
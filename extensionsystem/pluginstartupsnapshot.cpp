@@ -0,0 +1,148 @@
+﻿#include "pluginstartupsnapshot.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include "pluginmanager.h"
+#include "pluginspecification.h"
+
+namespace ExtensionSystem {
+
+namespace Constants
+{
+constexpr quint32 kSnapshotMagic = 0x50535353; // "PSSS"
+constexpr quint32 kSnapshotFormatVersion = 1;
+constexpr QDataStream::Version kSnapshotStreamVersion = QDataStream::Qt_5_15;
+}
+
+PluginStartupSnapshot::PluginStartupSnapshot(const QString &fileName)
+    : m_fileName(fileName)
+{
+}
+
+QString PluginStartupSnapshot::fileName() const
+{
+    return m_fileName;
+}
+
+QByteArray PluginStartupSnapshot::key(const QVector<PluginSpecification *> &specs)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(Constants::kSnapshotStreamVersion);
+    out << Constants::kSnapshotFormatVersion << PluginManager::instance().pluginIID()
+        << PluginManager::platformName() << quint32(specs.size());
+    for (const PluginSpecification *spec : specs) {
+        out << spec->m_filePath << spec->m_name << spec->m_version << spec->m_compatVersion
+            << spec->m_versionNumber.packed() << spec->m_compatVersionNumber.packed()
+            << spec->m_platformSpecification << spec->m_enabledBySettings
+            << quint32(spec->m_dependencies.size());
+        for (const PluginDependency &dep : spec->m_dependencies)
+            out << dep.name << dep.version.packed() << quint8(dep.type);
+    }
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+bool PluginStartupSnapshot::restore(const QVector<PluginSpecification *> &specs,
+                                    QVector<PluginSpecification *> *queue)
+{
+    for (const PluginSpecification *spec : specs) {
+        if (spec->hasError() || spec->m_state != PluginState::Read)
+            return false;
+    }
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(Constants::kSnapshotStreamVersion);
+    quint32 magic = 0;
+    quint32 formatVersion = 0;
+    QByteArray snapshotKey;
+    in >> magic >> formatVersion >> snapshotKey;
+    if (in.status() != QDataStream::Ok || magic != Constants::kSnapshotMagic
+        || formatVersion != Constants::kSnapshotFormatVersion || snapshotKey != key(specs)) {
+        return false;
+    }
+
+    // nothing is applied before the whole snapshot has been read and checked
+    const auto isIndex = [](quint32 index, qsizetype size) { return index < quint64(size); };
+    QVector<bool> available(specs.size());
+    QVector<QVector<std::pair<quint32, quint32>>> edges(specs.size());
+    for (qsizetype i = 0; i < specs.size(); ++i) {
+        quint32 count = 0;
+        in >> available[i] >> count;
+        for (quint32 j = 0; j < count && in.status() == QDataStream::Ok; ++j) {
+            quint32 dependency = 0;
+            quint32 target = 0;
+            in >> dependency >> target;
+            if (!isIndex(dependency, specs.at(i)->m_dependencies.size())
+                || !isIndex(target, specs.size())) {
+                return false;
+            }
+            edges[i].append({dependency, target});
+        }
+    }
+    quint32 count = 0;
+    in >> count;
+    if (in.status() != QDataStream::Ok || count > quint32(specs.size()))
+        return false;
+    QVector<PluginSpecification *> order;
+    order.reserve(count);
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint32 index = 0;
+        in >> index;
+        if (!isIndex(index, specs.size()))
+            return false;
+        order.append(specs.at(index));
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    for (qsizetype i = 0; i < specs.size(); ++i) {
+        PluginSpecification *spec = specs.at(i);
+        spec->m_availableForHostPlatform = available.at(i);
+        spec->m_dependencySpecifications.clear();
+        spec->m_dependencySpecifications.reserve(edges.at(i).size());
+        for (const auto &[dependency, target] : edges.at(i))
+            spec->m_dependencySpecifications.insert(spec->m_dependencies.at(dependency), specs.at(target));
+        spec->m_state = PluginState::Resolved;
+    }
+    *queue = order;
+    return true;
+}
+
+bool PluginStartupSnapshot::save(const QVector<PluginSpecification *> &specs,
+                                 const QVector<PluginSpecification *> &queue)
+{
+    // failures are reported during resolution, a snapshot would hide them
+    QHash<const PluginSpecification *, quint32> indexOf;
+    indexOf.reserve(specs.size());
+    for (const PluginSpecification *spec : specs) {
+        if (spec->hasError() || spec->m_state != PluginState::Resolved)
+            return false;
+        indexOf.insert(spec, quint32(indexOf.size()));
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(Constants::kSnapshotStreamVersion);
+    out << Constants::kSnapshotMagic << Constants::kSnapshotFormatVersion << key(specs);
+    for (const PluginSpecification *spec : specs) {
+        const QHash<PluginDependency, PluginSpecification *> &deps = spec->m_dependencySpecifications;
+        out << spec->isAvailableForHostPlatform() << quint32(deps.size());
+        for (auto it = deps.cbegin(), end = deps.cend(); it != end; ++it)
+            out << quint32(spec->m_dependencies.indexOf(it.key())) << indexOf.value(it.value());
+    }
+    out << quint32(queue.size());
+    for (const PluginSpecification *spec : queue)
+        out << indexOf.value(spec);
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+} // namespace ExtensionSystem
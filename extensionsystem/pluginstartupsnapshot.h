@@ -0,0 +1,30 @@
+﻿#pragma once
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+namespace ExtensionSystem {
+
+class PluginSpecification;
+
+// Remembers how a plugin set was resolved: the load order, the resolved dependency
+// edges and which plugins are available on the host. The snapshot is keyed by a hash
+// over everything resolution depends on, so restore() fails for any other plugin set
+// and the caller resolves from scratch.
+class PluginStartupSnapshot
+{
+public:
+    explicit PluginStartupSnapshot(const QString &fileName);
+
+    QString fileName() const;
+
+    bool restore(const QVector<PluginSpecification *> &specs, QVector<PluginSpecification *> *queue);
+    bool save(const QVector<PluginSpecification *> &specs, const QVector<PluginSpecification *> &queue);
+
+private:
+    static QByteArray key(const QVector<PluginSpecification *> &specs);
+
+    QString m_fileName;
+};
+
+} // namespace ExtensionSystem
@@ -0,0 +1,105 @@
+﻿#pragma once
+#include <QString>
+#include <QStringView>
+#include <compare>
+#include <optional>
+#include <string_view>
+#include "extensionsystemglobal.h"
+
+namespace ExtensionSystem {
+
+// A plugin version "major[.minor[.patch]][_build]", packed into one integer so
+// that versions compare with a single integer comparison. Each part is limited
+// to 16 bits.
+class PluginVersion
+{
+public:
+    constexpr PluginVersion() = default;
+    constexpr PluginVersion(quint16 majorVersion,
+                            quint16 minorVersion = 0,
+                            quint16 patchVersion = 0,
+                            quint16 buildVersion = 0)
+        : m_value((quint64(majorVersion) << 48) | (quint64(minorVersion) << 32)
+                  | (quint64(patchVersion) << 16) | buildVersion)
+    {}
+
+    static constexpr std::optional<PluginVersion> fromString(std::string_view version)
+    {
+        return parse(version.data(), qsizetype(version.size()));
+    }
+
+    static std::optional<PluginVersion> fromString(QStringView version)
+    {
+        return parse(version.utf16(), version.size());
+    }
+
+    static constexpr PluginVersion fromPacked(quint64 value)
+    {
+        PluginVersion version;
+        version.m_value = value;
+        return version;
+    }
+
+    constexpr quint16 majorVersion() const { return quint16(m_value >> 48); }
+    constexpr quint16 minorVersion() const { return quint16(m_value >> 32); }
+    constexpr quint16 patchVersion() const { return quint16(m_value >> 16); }
+    constexpr quint16 buildVersion() const { return quint16(m_value); }
+    constexpr quint64 packed() const { return m_value; }
+
+    QString toString() const
+    {
+        QString result = QString::number(majorVersion()) + QLatin1Char('.')
+                         + QString::number(minorVersion()) + QLatin1Char('.')
+                         + QString::number(patchVersion());
+        if (buildVersion())
+            result += QLatin1Char('_') + QString::number(buildVersion());
+        return result;
+    }
+
+    friend constexpr bool operator==(PluginVersion, PluginVersion) = default;
+    friend constexpr auto operator<=>(PluginVersion, PluginVersion) = default;
+
+private:
+    template<typename Char>
+    static constexpr std::optional<PluginVersion> parse(const Char *data, qsizetype size)
+    {
+        quint16 parts[4] = {};
+        qsizetype pos = 0;
+        // index 0..2 are separated by '.', the build number is introduced by '_'
+        for (int part = 0; part < 4; ++part) {
+            if (part > 0) {
+                if (pos == size)
+                    break;
+                const Char separator = data[pos];
+                if (separator == Char('_'))
+                    part = 3;
+                else if (separator != Char('.') || part == 3)
+                    return std::nullopt;
+                ++pos;
+            }
+            const qsizetype start = pos;
+            quint32 value = 0;
+            for (; pos < size && data[pos] >= Char('0') && data[pos] <= Char('9'); ++pos) {
+                value = value * 10 + quint32(data[pos] - Char('0'));
+                if (value > 0xffff)
+                    return std::nullopt;
+            }
+            if (pos == start)
+                return std::nullopt;
+            parts[part] = quint16(value);
+        }
+        if (pos != size)
+            return std::nullopt;
+        return PluginVersion(parts[0], parts[1], parts[2], parts[3]);
+    }
+
+    quint64 m_value = 0;
+};
+
+static_assert(PluginVersion::fromString("4.12.1_3") == PluginVersion(4, 12, 1, 3));
+static_assert(PluginVersion::fromString("4_3") == PluginVersion(4, 0, 0, 3));
+static_assert(PluginVersion::fromString("4.12") < PluginVersion(4, 12, 1));
+static_assert(!PluginVersion::fromString("4.") && !PluginVersion::fromString("4.1.2.3")
+              && !PluginVersion::fromString("4_1.2") && !PluginVersion::fromString(""));
+
+} // namespace ExtensionSystem
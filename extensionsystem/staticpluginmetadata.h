@@ -0,0 +1,122 @@
+﻿#pragma once
+#include <optional>
+#include <span>
+#include <string_view>
+#include "pluginspecification.h"
+#include "pluginversion.h"
+
+namespace ExtensionSystem {
+
+struct StaticPluginDependency
+{
+    std::string_view name;
+    PluginVersion version;
+    PluginDependency::Type type = PluginDependency::Type::Required;
+};
+
+struct StaticPluginArgument
+{
+    std::string_view name;
+    std::string_view parameter = {};
+    std::string_view description = {};
+};
+
+// Metadata of a plugin linked into the application, declared in C++ instead of
+// JSON. Declared constexpr and registered through
+// PluginManager::registerStaticPluginMetaData<>(), invalid metadata does not
+// compile, and the spec is built without parsing anything. The spec's metaData()
+// is empty.
+struct StaticPluginMetaData
+{
+    std::string_view name;
+    PluginVersion version;
+    // defaults to version
+    std::optional<PluginVersion> compatVersion = {};
+    QtPluginInstanceFunction instance = nullptr;
+    std::string_view vendor = {};
+    std::string_view category = {};
+    std::string_view copyright = {};
+    std::string_view description = {};
+    std::string_view longDescription = {};
+    std::string_view url = {};
+    std::string_view license = {};
+    // a regular expression, only checked at runtime
+    std::string_view platform = {};
+    bool required = false;
+    bool experimental = false;
+    bool disabledByDefault = false;
+    bool threadSafeInitialize = false;
+    bool threadSafeShutdown = false;
+    bool lazy = false;
+    int delayedInitializePriority = 0;
+    std::span<const std::string_view> interfaces = {};
+    std::span<const StaticPluginDependency> dependencies = {};
+    std::span<const StaticPluginArgument> arguments = {};
+};
+
+// The helpers below are consteval, a violation is reported by the compiler at the
+// throw expression.
+
+consteval PluginVersion pluginVersion(std::string_view version)
+{
+    const std::optional<PluginVersion> result = PluginVersion::fromString(version);
+    if (!result)
+        throw "invalid plugin version, expected major[.minor[.patch]][_build]";
+    return *result;
+}
+
+// accepts the spelling of a dependency's "Type" in JSON metadata
+consteval PluginDependency::Type pluginDependencyType(std::string_view type)
+{
+    const auto equals = [type](std::string_view expected) {
+        if (type.size() != expected.size())
+            return false;
+        for (std::size_t i = 0; i < type.size(); ++i) {
+            const char c = type[i] >= 'A' && type[i] <= 'Z' ? char(type[i] - 'A' + 'a') : type[i];
+            if (c != expected[i])
+                return false;
+        }
+        return true;
+    };
+    if (equals("required"))
+        return PluginDependency::Type::Required;
+    if (equals("optional"))
+        return PluginDependency::Type::Optional;
+    if (equals("test"))
+        return PluginDependency::Type::Test;
+    throw "dependency type must be \"required\", \"optional\" or \"test\"";
+}
+
+// the same rules readMetaData() applies to JSON metadata
+consteval bool isValidStaticPluginMetaData(const StaticPluginMetaData &metaData)
+{
+    if (metaData.name.empty())
+        throw "plugin metadata: \"Name\" is empty";
+    if (!metaData.instance)
+        throw "plugin metadata: no instance function";
+    if (metaData.compatVersion && metaData.version < *metaData.compatVersion)
+        throw "plugin metadata: \"CompatVersion\" is newer than \"Version\"";
+    for (std::string_view interfaceName : metaData.interfaces) {
+        if (interfaceName.empty())
+            throw "plugin metadata: an interface name is empty";
+    }
+    for (const StaticPluginDependency &dependency : metaData.dependencies) {
+        if (dependency.name.empty())
+            throw "plugin metadata: a dependency's \"Name\" is empty";
+        if (dependency.type != PluginDependency::Type::Required
+            && dependency.type != PluginDependency::Type::Optional
+            && dependency.type != PluginDependency::Type::Test) {
+            throw "plugin metadata: invalid dependency type";
+        }
+    }
+    for (const StaticPluginArgument &argument : metaData.arguments) {
+        if (argument.name.empty())
+            throw "plugin metadata: an argument's \"Name\" is empty";
+    }
+    return true;
+}
+
+static_assert(pluginVersion("4.12.1") == PluginVersion(4, 12, 1));
+static_assert(pluginDependencyType("Optional") == PluginDependency::Type::Optional);
+
+} // namespace ExtensionSystem
@@ -1,42 +1,194 @@
 ﻿#include "settings.h"
+#include <QThread>
+#include <algorithm>
 
 namespace Utils {
 
+namespace Constants
+{
+constexpr int kWriteBehindDelay = 500;
+}
+
+Settings::Settings()
+    : m_writeBehindDelay(Constants::kWriteBehindDelay)
+{
+}
+
+Settings::~Settings()
+{
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        m_stopping = true;
+        m_wakeUp.wakeAll();
+    }
+    if (m_writer) {
+        m_writer->wait();
+        delete m_writer;
+    }
+    flush();
+}
 
 void Settings::beginGroup(const QString &prefix)
 {
-    QSettings::beginGroup(prefix);
+    m_group = absoluteKey(prefix);
 }
 
 QVariant Settings::value(const QString &key) const
 {
-    return QSettings::value(key);
+    return cachedValue(absoluteKey(key)).value_or(QVariant());
 }
 
 QVariant Settings::value(const QString &key, const QVariant &def) const
 {
-    return QSettings::value(key, def);
+    return cachedValue(absoluteKey(key)).value_or(def);
 }
 
 void Settings::setValue(const QString &key, const QVariant &value)
 {
-    QSettings::setValue(key, value);
+    write(absoluteKey(key), value);
 }
 
 void Settings::remove(const QString &key)
 {
-    QSettings::remove(key);
+    write(absoluteKey(key), std::nullopt);
 }
 
 bool Settings::contains(const QString &key) const
 {
-    return QSettings::contains(key);
+    return cachedValue(absoluteKey(key)).has_value();
 }
 
 QStringList Settings::childKeys() const
 {
-    return QSettings::childKeys();
+    const_cast<Settings *>(this)->flush();
+    QMutexLocker locker(&m_backendMutex);
+    auto self = const_cast<Settings *>(this);
+    self->QSettings::beginGroup(m_group);
+    const QStringList keys = QSettings::childKeys();
+    self->QSettings::endGroup();
+    return keys;
 }
 
-} // namespace Utils
+void Settings::flush()
+{
+    // Holding the backend lock while taking the pending batch keeps batches in order
+    QMutexLocker backendLocker(&m_backendMutex);
+    QVector<PendingWrite> pending;
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        pending.swap(m_pending);
+    }
+    if (pending.isEmpty())
+        return;
+    for (const PendingWrite &write : std::as_const(pending)) {
+        if (write.value)
+            QSettings::setValue(write.key, *write.value);
+        else
+            QSettings::remove(write.key);
+    }
+    QSettings::sync();
+}
+
+int Settings::writeBehindDelay() const
+{
+    QMutexLocker locker(&m_cacheMutex);
+    return m_writeBehindDelay;
+}
+
+void Settings::setWriteBehindDelay(int msecs)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    m_writeBehindDelay = msecs;
+}
 
+QString Settings::absoluteKey(const QString &key) const
+{
+    if (m_group.isEmpty())
+        return key;
+    return m_group + QLatin1Char('/') + key;
+}
+
+Settings::CachedValue Settings::cachedValue(const QString &key) const
+{
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        const auto it = m_cache.constFind(key);
+        if (it != m_cache.cend())
+            return it.value();
+        if (isRemovedByPendingWrite(key))
+            return std::nullopt;
+    }
+    // The backend has seen every write that left m_pending before the backend lock
+    // was taken, the ones queued since are checked again below.
+    QMutexLocker backendLocker(&m_backendMutex);
+    CachedValue value;
+    if (QSettings::contains(key))
+        value = QSettings::value(key);
+    QMutexLocker locker(&m_cacheMutex);
+    // A concurrent write is newer than what was just read
+    const auto it = m_cache.constFind(key);
+    if (it != m_cache.cend())
+        return it.value();
+    if (isRemovedByPendingWrite(key))
+        value.reset();
+    m_cache.insert(key, value);
+    return value;
+}
+
+// Whether a queued removal of a group hides the key. Needs m_cacheMutex.
+bool Settings::isRemovedByPendingWrite(const QString &key) const
+{
+    return std::any_of(m_pending.cbegin(), m_pending.cend(), [&key](const PendingWrite &write) {
+        return !write.value && key.startsWith(write.key + QLatin1Char('/'));
+    });
+}
+
+void Settings::write(const QString &key, const CachedValue &value)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    const auto cached = m_cache.constFind(key);
+    if (cached != m_cache.cend() && cached.value() == value)
+        return;
+    const QString prefix = key + QLatin1Char('/');
+    if (!value) {
+        // Removing a key also removes everything below it
+        for (auto it = m_cache.begin(), end = m_cache.end(); it != end; ++it) {
+            if (it.key().startsWith(prefix))
+                it.value().reset();
+        }
+    }
+    m_cache.insert(key, value);
+    if (m_pending.isEmpty())
+        m_flushDue.setRemainingTime(m_writeBehindDelay);
+    // The backend sees writes in the order they were made. An older write of the
+    // same key is superseded, and so are older writes below a removed key.
+    const auto superseded = [&key, &prefix, &value](const PendingWrite &write) {
+        return write.key == key || (!value && write.key.startsWith(prefix));
+    };
+    m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), superseded), m_pending.end());
+    m_pending.append({key, value});
+    if (!m_writer) {
+        m_writer = QThread::create([this] { writeBehind(); });
+        m_writer->setObjectName(QLatin1String("SettingsWriter"));
+        m_writer->start(QThread::LowPriority);
+    }
+    m_wakeUp.wakeOne();
+}
+
+void Settings::writeBehind()
+{
+    QMutexLocker locker(&m_cacheMutex);
+    while (!m_stopping) {
+        if (m_pending.isEmpty()) {
+            m_wakeUp.wait(&m_cacheMutex);
+        } else if (!m_flushDue.hasExpired()) {
+            m_wakeUp.wait(&m_cacheMutex, m_flushDue);
+        } else {
+            locker.unlock();
+            flush();
+            locker.relock();
+        }
+    }
+}
+
+} // namespace Utils
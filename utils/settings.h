@@ -1,30 +1,84 @@
 ﻿#pragma once
 #include "utilsglobal.h"
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QMutex>
 #include <QSettings>
+#include <QVector>
+#include <QWaitCondition>
+#include <optional>
 
 namespace Utils {
 
+// Writes are kept in memory, coalesced per key and written to the backend by a
+// background thread at most writeBehindDelay() after the first pending change.
+// Reads are answered from the same cache. Call flush() to write pending changes
+// right away, e.g. on shutdown.
 class UTILS_EXPORT Settings : private QSettings
 {
 public:
     using QSettings::setParent;
+
+    Settings();
+    ~Settings() override;
+
+    void beginGroup(const QString &prefix);
+    QVariant value(const QString &key) const;
+    QVariant value(const QString &key, const QVariant &def) const;
+    void setValue(const QString &key, const QVariant &value);
+    void remove(const QString &key);
+    bool contains(const QString &key) const;
+    QStringList childKeys() const;
+
+    void flush();
+    int writeBehindDelay() const;
+    void setWriteBehindDelay(int msecs);
+
+    // Nothing is queued for the backend if the stored value stays the same
     template<typename T>
     void setValueWithDefault(const QString &key, const T &val, const T &defaultValue)
     {
-        if (val == defaultValue)
-            remove(key);
-        else
+        if (val == defaultValue) {
+            if (contains(key))
+                remove(key);
+        } else if (value(key) != QVariant::fromValue(val)) {
             setValue(key, val);
+        }
     }
 
     template<typename T>
     void setValueWithDefault(const QString &key, const T &val)
     {
-        if (val == T())
-            remove(key);
-        else
-            setValue(key, val);
+        setValueWithDefault(key, val, T());
     }
+
+private:
+    using CachedValue = std::optional<QVariant>; // nullopt: known to be absent
+    struct PendingWrite
+    {
+        QString key;
+        CachedValue value;
+    };
+
+    QString absoluteKey(const QString &key) const;
+    CachedValue cachedValue(const QString &key) const;
+    bool isRemovedByPendingWrite(const QString &key) const;
+    void write(const QString &key, const CachedValue &value);
+    void writeBehind();
+
+    QString m_group;
+    mutable QMutex m_cacheMutex;
+    mutable QHash<QString, CachedValue> m_cache;
+    // in write order, at most one entry per key
+    QVector<PendingWrite> m_pending;
+    QDeadlineTimer m_flushDue;
+    int m_writeBehindDelay;
+    QWaitCondition m_wakeUp;
+    bool m_stopping = false;
+    QThread *m_writer = nullptr;
+
+    // Serializes access to QSettings, which is only reentrant
+    mutable QMutex m_backendMutex;
 };
 
 } // namespace Utils
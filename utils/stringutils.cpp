@@ -19,4 +19,18 @@ bool readMultiLineString(const QJsonValue &value, QString &out)
     }
     return true;
 }
+
+bool isMultiLineString(const QJsonValue &value)
+{
+    if (value.isString())
+        return true;
+    if (!value.isArray())
+        return false;
+    const QJsonArray array = value.toArray();
+    for (const QJsonValue &v : array) {
+        if (!v.isString())
+            return false;
+    }
+    return true;
+}
 } // namespace Utils
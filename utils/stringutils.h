@@ -3,4 +3,5 @@
 #include <QJsonValue>
 namespace Utils {
 bool readMultiLineString(const QJsonValue &value, QString &out);
+bool isMultiLineString(const QJsonValue &value);
 }